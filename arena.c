@@ -0,0 +1,147 @@
+/*
+ * arena.c - per-line memory store
+ *
+ * This source code is licensed under the MIT License.
+ * See the file COPYING for more details.
+ *
+ * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN  (sizeof(void *))
+
+/*
+ * _new_chunk - allocate a chunk which can hold at least `size' bytes
+ */
+static arena_chunk_t *_new_chunk(size_t size)
+{
+    arena_chunk_t *chunk;
+
+    if (size < ARENA_CHUNK_SIZE)  size = ARENA_CHUNK_SIZE;
+    chunk = (arena_chunk_t *) malloc(sizeof(arena_chunk_t) + size);
+    if (chunk == NULL) {
+        fprintf(stderr, "Bad allocation (arena) \n");
+        exit(EXIT_FAILURE);
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+
+    return chunk;
+}
+
+/**
+ * init_arena - create an empty store
+ */
+arena_t *init_arena(void)
+{
+    arena_t *arena = (arena_t *) malloc(sizeof(arena_t));
+    if (arena == NULL) {
+        fprintf(stderr, "Bad allocation (arena) \n");
+        exit(EXIT_FAILURE);
+    }
+    arena->first = arena->current = _new_chunk(0);
+    arena->allocs = arena->bytes = 0;
+    arena->chunks = 1;
+
+    return arena;
+}
+
+/**
+ * arena_alloc - allocate `size' bytes which live until the store is reset
+ * @arena: store to allocate from
+ * @size: number of bytes
+ */
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    arena_chunk_t *chunk = arena->current;
+    void *p;
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    while (chunk->size - chunk->used < size) {
+        if (chunk->next == NULL || chunk->next->size < size) {
+            // Splice a fresh chunk in front of any smaller leftover one.
+            arena_chunk_t *fresh = _new_chunk(size);
+            fresh->next = chunk->next;
+            chunk->next = fresh;
+            arena->chunks++;
+        }
+        chunk = chunk->next;
+        chunk->used = 0;
+    }
+    arena->current = chunk;
+    p = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->allocs++;
+    arena->bytes += size;
+
+    return p;
+}
+
+/**
+ * arena_str - allocate a string of `length' characters and NUL terminate it
+ * @arena: store to allocate from
+ * @s: characters to copy, or NULL to leave the contents to the caller
+ * @length: number of characters
+ */
+str_t *arena_str(arena_t *arena, const char *s, size_t length)
+{
+    str_t *str = (str_t *) arena_alloc(arena, sizeof(str_t) + length + 1);
+
+    str->length = length;
+    if (s != NULL)  memcpy(str->data, s, length);
+    str->data[length] = '\0';
+
+    return str;
+}
+
+/**
+ * arena_strcat - return a new string which is `head' followed by `s'
+ * @arena: store to allocate from
+ * @head: leading string, may be NULL
+ * @s: characters to append
+ * @length: number of characters in `s'
+ */
+str_t *arena_strcat(arena_t *arena, const str_t *head,
+                    const char *s, size_t length)
+{
+    const size_t head_length = (head != NULL) ? head->length : 0;
+    str_t *str = arena_str(arena, NULL, head_length + length);
+
+    if (head != NULL)  memcpy(str->data, head->data, head_length);
+    memcpy(str->data + head_length, s, length);
+
+    return str;
+}
+
+/**
+ * arena_reset - release everything allocated from the store at once
+ * @arena: store to reset
+ */
+void arena_reset(arena_t *arena)
+{
+    arena->current = arena->first;
+    arena->first->used = 0;
+    arena->allocs = arena->bytes = 0;
+}
+
+/**
+ * free_arena - release the store and its chunks
+ * @arena: store to free
+ */
+void free_arena(arena_t *arena)
+{
+    arena_chunk_t *chunk = arena->first, *next;
+
+    while (chunk != NULL) {
+        next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
@@ -0,0 +1,89 @@
+/*
+ * arena.h - per-line memory store
+ *
+ * This source code is licensed under the MIT License.
+ * See the file COPYING for more details.
+ *
+ * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
+ */
+
+#ifndef PSH_ARENA_H_
+#define PSH_ARENA_H_
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE  (4096*16)
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+} arena_chunk_t;
+
+/*
+ * Bump-pointer store for everything a line needs: the tokenizer, the
+ * parser, the syntax tree and the commands.  Chunks are kept across
+ * arena_reset() and reused in order, so a line which fits in the chunks
+ * of the previous ones does not call malloc at all.
+ */
+typedef struct arena {
+    arena_chunk_t *first;
+    arena_chunk_t *current;
+    size_t allocs;  // allocations since the last reset
+    size_t bytes;   // bytes handed out since the last reset
+    size_t chunks;  // chunks owned by the arena
+} arena_t;
+
+/*
+ * Length-prefixed string.  `data' is always NUL terminated so that it
+ * can be handed to libc as is.
+ */
+typedef struct str {
+    size_t length;
+    char data[];
+} str_t;
+
+/**
+ * init_arena - create an empty store
+ */
+arena_t *init_arena(void);
+
+/**
+ * arena_alloc - allocate `size' bytes which live until the store is reset
+ * @arena: store to allocate from
+ * @size: number of bytes
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * arena_str - allocate a string of `length' characters and NUL terminate it
+ * @arena: store to allocate from
+ * @s: characters to copy, or NULL to leave the contents to the caller
+ * @length: number of characters
+ */
+str_t *arena_str(arena_t *arena, const char *s, size_t length);
+
+/**
+ * arena_strcat - return a new string which is `head' followed by `s'
+ * @arena: store to allocate from
+ * @head: leading string, may be NULL
+ * @s: characters to append
+ * @length: number of characters in `s'
+ */
+str_t *arena_strcat(arena_t *arena, const str_t *head,
+                    const char *s, size_t length);
+
+/**
+ * arena_reset - release everything allocated from the store at once
+ * @arena: store to reset
+ */
+void arena_reset(arena_t *arena);
+
+/**
+ * free_arena - release the store and its chunks
+ * @arena: store to free
+ */
+void free_arena(arena_t *arena);
+
+#endif  // PSH_ARENA_H_
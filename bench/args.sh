@@ -0,0 +1,23 @@
+#!/bin/sh
+#
+# args.sh - run a script line with 100k arguments through psh end to end
+#
+# The line goes through the tokenizer, the parser, the executor walk and
+# word expansion before `echo' runs inside the shell.
+
+PSH=${PSH:-../psh}
+ROUNDS=5
+script=$(mktemp)
+trap 'rm -f "$script"' EXIT
+
+awk 'BEGIN { printf "echo"; for (i = 0; i < 100000; i++) printf " a%d$HOME", i;
+             printf " > /dev/null\n" }' > "$script"
+
+start=$(date +%s%N)
+i=0
+while [ $i -lt $ROUNDS ]; do
+    "$PSH" "$script" || exit 1
+    i=$((i + 1))
+done
+end=$(date +%s%N)
+printf "%-10s %8.2f ms/run\n" args $(((end - start) / ROUNDS / 10000))e-2
@@ -0,0 +1,26 @@
+#!/bin/sh
+#
+# expand.sh - time word expansion of lines full of $VAR and ~ pieces
+#
+# Each line is expanded by psh and handed to `echo', which runs inside
+# the shell, so the time is mostly tokenizing and expanding.
+
+PSH=${PSH:-../psh}
+LINES=200
+script=$(mktemp)
+trap 'rm -f "$script"' EXIT
+
+awk -v lines=$LINES 'BEGIN {
+    for (n = 0; n < lines; n++) {
+        printf "echo";
+        for (i = 0; i < 500; i++)
+            printf " $HOME$USER$HOME/x$PATH ~ ~/src ~root";
+        printf " > /dev/null\n";
+    }
+}' > "$script"
+
+start=$(date +%s%N)
+"$PSH" "$script" || exit 1
+end=$(date +%s%N)
+printf "%-10s %8.2f us/line  (%d words each)\n" expand \
+       $(((end - start) / LINES / 10))e-2 2000
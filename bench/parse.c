@@ -0,0 +1,95 @@
+/*
+ * parse.c - parse time and arena use of lines with 100k arguments
+ *
+ * This source code is licensed under the MIT License.
+ * See the file COPYING for more details.
+ *
+ * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../arena.h"
+#include "../parser.h"
+#include "../tokenizer.h"
+
+#define BENCH_ARGUMENTS  100000
+#define BENCH_STAGES     PIPE_MAX
+#define BENCH_ROUNDS     20
+
+/*
+ * _now - get a monotonic time in seconds
+ */
+static double _now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * _make_line - build `stages' piped commands sharing `count' arguments
+ */
+static char *_make_line(const int count, const int stages)
+{
+    char *line = (char *) malloc((size_t) count * 16 + stages * 8 + 16);
+    size_t n = 0;
+    int i;
+
+    if (line == NULL) {
+        fprintf(stderr, "Bad allocation (bench) \n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < count; i++) {
+        if (i % (count / stages) == 0)
+            n += sprintf(line + n, (i == 0) ? "echo" : " | echo");
+        n += sprintf(line + n, " a%d$HOME", i);
+    }
+    line[n++] = '\n';
+    line[n] = '\0';
+
+    return line;
+}
+
+/*
+ * _run - parse `line' BENCH_ROUNDS times and print the time per parse
+ */
+static void _run(const char *name, const char *line)
+{
+    const size_t length = strlen(line);
+    arena_t *arena = init_arena();
+    double start = _now(), elapsed;
+    size_t allocs = 0, bytes = 0;
+    tree_t *tree;
+    int i;
+
+    for (i = 0; i < BENCH_ROUNDS; i++) {
+        arena_reset(arena);
+        tree = parse_input(init_parser(arena),
+                           init_tokenizer_slice(arena, line, length));
+        allocs = arena->allocs;
+        bytes = arena->bytes;
+    }
+    elapsed = _now() - start;
+    printf("%-10s %8.2f ms/parse  %zu nodes  %zu allocations  %zu bytes\n",
+           name, elapsed * 1e3 / BENCH_ROUNDS, (size_t) tree->count,
+           allocs, bytes);
+    free_arena(arena);
+}
+
+int main(void)
+{
+    char *args = _make_line(BENCH_ARGUMENTS, 1);
+    char *piped = _make_line(BENCH_ARGUMENTS, BENCH_STAGES);
+
+    _run("args", args);
+    _run("piped", piped);
+    free(args);
+    free(piped);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+/*
+ * spawn.c - latency of fork+exec against posix_spawn as the shell grows
+ *
+ * This source code is licensed under the MIT License.
+ * See the file COPYING for more details.
+ *
+ * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
+ */
+
+#include <errno.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_COMMAND  "/bin/true"
+#define BENCH_ROUNDS   200
+
+extern char **environ;
+
+/*
+ * _now - get a monotonic time in seconds
+ */
+static double _now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * _fork_exec - start the command as the shell did before posix_spawn
+ */
+static pid_t _fork_exec(char **argv)
+{
+    pid_t child = fork();
+
+    if (child == 0) {
+        execve(argv[0], argv, environ);
+        _exit(127);
+    }
+    return child;
+}
+
+/*
+ * _spawn - start the command as _spawn_exec() does
+ */
+static pid_t _spawn(char **argv)
+{
+    posix_spawn_file_actions_t actions;
+    pid_t child;
+
+    posix_spawn_file_actions_init(&actions);
+    if (posix_spawn(&child, argv[0], &actions, NULL, argv, environ) != 0)
+        child = -1;
+    posix_spawn_file_actions_destroy(&actions);
+    return child;
+}
+
+/*
+ * _run - print the microseconds from starting the command to reaping it
+ */
+static void _run(const char *name, pid_t (*start)(char **))
+{
+    char *argv[] = { BENCH_COMMAND, NULL };
+    double begin = _now();
+    pid_t child;
+    int i, wstatus;
+
+    for (i = 0; i < BENCH_ROUNDS; i++) {
+        child = start(argv);
+        if (child == -1) {
+            fprintf(stderr, "bench: %s: %s\n", name, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        while (waitpid(child, &wstatus, 0) == -1 && errno == EINTR)
+            ;
+    }
+    printf("  %-12s %8.1f us/command\n", name,
+           (_now() - begin) * 1e6 / BENCH_ROUNDS);
+}
+
+int main(void)
+{
+    const size_t sizes[] = { 0, 64, 512 };  // MB of touched heap
+    size_t i;
+    char *heap;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        heap = NULL;
+        if (sizes[i] > 0) {
+            heap = (char *) malloc(sizes[i] << 20);
+            if (heap == NULL) {
+                fprintf(stderr, "Bad allocation (bench) \n");
+                exit(EXIT_FAILURE);
+            }
+            memset(heap, 1, sizes[i] << 20);
+        }
+        printf("RSS +%zu MB\n", sizes[i]);
+        _run("fork+exec", _fork_exec);
+        _run("posix_spawn", _spawn);
+        free(heap);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+/*
+ * startup.c - exec-to-exit time of `sh -c exit' for psh, dash and bash
+ *
+ * This source code is licensed under the MIT License.
+ * See the file COPYING for more details.
+ *
+ * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
+ */
+
+#include <errno.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_ROUNDS  1000
+
+extern char **environ;
+
+/*
+ * _now - get a monotonic time in seconds
+ */
+static double _now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * _run - print the microseconds `shell -c script' takes from exec to exit
+ */
+static void _run(const char *shell, const char *script)
+{
+    char *argv[] = { (char *) shell, "-c", (char *) script, NULL };
+    double begin;
+    pid_t child;
+    int i, error, wstatus;
+
+    if (access(shell, X_OK) != 0) {
+        printf("  %-14s (not installed)\n", shell);
+        return;
+    }
+    begin = _now();
+    for (i = 0; i < BENCH_ROUNDS; i++) {
+        error = posix_spawn(&child, shell, NULL, NULL, argv, environ);
+        if (error != 0) {
+            fprintf(stderr, "bench: %s: %s\n", shell, strerror(error));
+            exit(EXIT_FAILURE);
+        }
+        while (waitpid(child, &wstatus, 0) == -1 && errno == EINTR)
+            ;
+    }
+    printf("  %-14s %8.1f us\n", shell, (_now() - begin) * 1e6 / BENCH_ROUNDS);
+}
+
+int main(int argc, char **argv)
+{
+    const char *psh = (argc > 1) ? argv[1] : "../psh";
+    const char *scripts[] = { "exit", "/bin/true" };
+    size_t i;
+
+    for (i = 0; i < sizeof(scripts) / sizeof(scripts[0]); i++) {
+        printf("-c '%s'\n", scripts[i]);
+        _run(psh, scripts[i]);
+        _run("/bin/dash", scripts[i]);
+        _run("/bin/bash", scripts[i]);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+/*
+ * tokenize.c - throughput of the tokenizer on long lines
+ *
+ * This source code is licensed under the MIT License.
+ * See the file COPYING for more details.
+ *
+ * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../arena.h"
+#include "../tokenizer.h"
+
+#define BENCH_LINE_SIZE  (1024 * 1024)
+#define BENCH_SECONDS    0.5
+
+/*
+ * _now - get a monotonic time in seconds
+ */
+static double _now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * _make_line - fill a line of `size' bytes with copies of `word'
+ */
+static char *_make_line(const char *word, const size_t size)
+{
+    const size_t length = strlen(word);
+    char *line = (char *) malloc(size + 1);
+    size_t n = 0;
+
+    if (line == NULL) {
+        fprintf(stderr, "Bad allocation (bench) \n");
+        exit(EXIT_FAILURE);
+    }
+    while (n + length + 1 <= size) {
+        memcpy(line + n, word, length);
+        n += length;
+        line[n++] = ' ';
+    }
+    line[n] = '\0';
+
+    return line;
+}
+
+/*
+ * _run - tokenize `line' over and over and print the bytes per second
+ */
+static void _run(const char *name, const char *line)
+{
+    const size_t length = strlen(line);
+    arena_t *arena = init_arena();
+    const token_t *token;
+    tokenizer_t *t;
+    size_t bytes = 0, tokens = 0;
+    double start = _now(), elapsed;
+
+    do {
+        arena_reset(arena);
+        t = init_tokenizer_slice(arena, line, length);
+        do {
+            token = next_token(t);
+            tokens++;
+        } while (token->spec != END_OF_FILE && token->spec != END_OF_LINE
+                 && token->spec != ERROR);
+        bytes += length;
+        elapsed = _now() - start;
+    } while (elapsed < BENCH_SECONDS);
+    printf("%-10s %8.1f MB/s  %10.0f tokens/s\n", name,
+           bytes / elapsed / 1e6, tokens / elapsed);
+    free_arena(arena);
+}
+
+int main(void)
+{
+    char *paths = _make_line("/usr/lib/x86_64-linux-gnu/libreadline.so.8",
+                             BENCH_LINE_SIZE);
+    char *words = _make_line("cc", BENCH_LINE_SIZE);
+    char *mixed = _make_line("-DNAME=value$HOME/include", BENCH_LINE_SIZE);
+
+    _run("paths", paths);
+    _run("words", words);
+    _run("mixed", mixed);
+    free(paths);
+    free(words);
+    free(mixed);
+
+    return EXIT_SUCCESS;
+}
@@ -7,62 +7,535 @@
  * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
  */
 
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <spawn.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "builtins.h"
+#include "fd.h"
+#include "hash.h"
+#include "jobs.h"
+#include "vars.h"
+
+static int _builtin_cd(command_t *current_command, tree_t *tree);
+static int _builtin_exit(command_t *current_command, tree_t *tree);
+static int _builtin_hash(command_t *current_command, tree_t *tree);
+static int _builtin_echo(command_t *current_command, tree_t *tree);
+static int _builtin_pwd(command_t *current_command, tree_t *tree);
+static int _builtin_export(command_t *current_command, tree_t *tree);
+static int _builtin_chunked(command_t *current_command, tree_t *tree);
+static int _builtin_jobs(command_t *current_command, tree_t *tree);
+static int _builtin_wait(command_t *current_command, tree_t *tree);
+static int _builtin_parallel(command_t *current_command, tree_t *tree);
+
+/*
+ * Adding a builtin only takes a line here; its slot in the lookup table is
+ * worked out the first time a command is looked up.
+ */
+static const builtin_t builtins[] = {
+    { "cd",     _builtin_cd,     true, false },
+    { "exit",   _builtin_exit,   true, false },
+    { "hash",   _builtin_hash,   true, false },
+    { "echo",   _builtin_echo,   true, true },
+    { "pwd",    _builtin_pwd,    true, true },
+    { "export", _builtin_export, true, false },
+    { "chunked", _builtin_chunked, true, false },
+    { "jobs",   _builtin_jobs,   true, false },
+    { "wait",   _builtin_wait,   true, false },
+    { "parallel", _builtin_parallel, true, false },
+};
+
+#define BUILTIN_COUNT  (sizeof(builtins) / sizeof(builtins[0]))
+
+static uint8_t builtin_slots[BUILTIN_SLOTS];  // index + 1, 0 when empty
+static uint32_t builtin_seed;
+static bool builtin_slots_ready = false;
 
 /*
- * _check_cd - check whether cd is in `current_command' and if so, do chdir
+ * _builtin_slot - get the slot of `name' under the current seed
  */
-static bool _check_cd(command_t *current_command, node_t *root)
+static inline uint32_t _builtin_slot(const char *name, const size_t length)
+{
+    return ((hash_string(name, length) ^ builtin_seed) * 2654435761u)
+        >> (32 - BUILTIN_SLOT_BITS);
+}
+
+/*
+ * _init_builtin_slots - find a seed under which no two builtins collide
+ *
+ * With a handful of names in 64 slots a perfect seed turns up within a
+ * few tries, after which every lookup is one hash and one strcmp.
+ */
+static void _init_builtin_slots(void)
+{
+    size_t i;
+    uint32_t slot;
+
+    for (builtin_seed = 0; ; builtin_seed++) {
+        memset(builtin_slots, 0, sizeof(builtin_slots));
+        for (i = 0; i < BUILTIN_COUNT; i++) {
+            slot = _builtin_slot(builtins[i].name, strlen(builtins[i].name));
+            if (builtin_slots[slot] != 0)  break;
+            builtin_slots[slot] = i + 1;
+        }
+        if (i == BUILTIN_COUNT)  break;
+    }
+    builtin_slots_ready = true;
+}
+
+/*
+ * _builtin_cd - change the working directory to argv[1] or $HOME
+ */
+static int _builtin_cd(command_t *current_command, tree_t *tree)
 {
-    bool result;
     const char *path;
-    switch (strcmp(current_command->cmd, "cd")) {
-    case 0:
-        if (current_command->argv[1] == NULL)
-            path = getenv("HOME");
-        else
-            path = current_command->argv[1];
-        if (chdir(path) != 0) {
-            print_error("cd: no such directry in pwd.\n", root);
+
+    if (current_command->argv[1] == NULL)
+        path = var_get("HOME");
+    else
+        path = current_command->argv[1];
+    if (path == NULL || chdir(path) != 0) {
+        fprintf(stderr, "cd: no such directry in pwd.\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * _builtin_exit - leave the shell with status argv[1], 0 by default
+ */
+static int _builtin_exit(command_t *current_command, tree_t *tree)
+{
+    const char *status = current_command->argv[1];
+
+    exit(status == NULL ? EXIT_SUCCESS : atoi(status));
+    return EXIT_FAILURE;
+}
+
+/*
+ * _builtin_hash - list or, with -r, clear the remembered command locations
+ */
+static int _builtin_hash(command_t *current_command, tree_t *tree)
+{
+    const char *option = current_command->argv[1];
+
+    if (option == NULL) {
+        hash_print(stdout);
+    } else if (strcmp(option, "-r") == 0) {
+        hash_clear();
+    } else {
+        fprintf(stderr, "hash: usage: hash [-r]\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * _builtin_echo - print the arguments separated by spaces
+ */
+static int _builtin_echo(command_t *current_command, tree_t *tree)
+{
+    int i = 1;
+    bool newline = true;
+
+    if (current_command->argv[1] != NULL
+        && strcmp(current_command->argv[1], "-n") == 0) {
+        newline = false;
+        i++;
+    }
+    for (; i < current_command->argc; i++) {
+        fputs(current_command->argv[i], stdout);
+        if (i + 1 < current_command->argc)  putchar(' ');
+    }
+    if (newline)  putchar('\n');
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * _builtin_pwd - print the working directory
+ */
+static int _builtin_pwd(command_t *current_command, tree_t *tree)
+{
+    char path[PATH_MAX];
+
+    if (getcwd(path, sizeof(path)) == NULL) {
+        perror("pwd");
+        return EXIT_FAILURE;
+    }
+    puts(path);
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * _builtin_export - export NAME or NAME=value to spawned commands
+ */
+static int _builtin_export(command_t *current_command, tree_t *tree)
+{
+    const char *arg, *equal, *value;
+    int i;
+
+    for (i = 1; i < current_command->argc; i++) {
+        arg = current_command->argv[i];
+        equal = strchr(arg, '=');
+        if (equal != NULL) {
+            var_set(arg, equal - arg, equal + 1, true);
+        } else {
+            value = var_get(arg);
+            var_set(arg, strlen(arg), (value == NULL) ? "" : value, true);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * _wait_batch - reap one batch of chunked and fold its status into `status'
+ */
+static int _wait_batch(const pid_t pid, int status)
+{
+    int wstatus;
+
+    while (waitpid(pid, &wstatus, 0) == -1)
+        if (errno != EINTR)  return status;
+    if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0)
+        status = CHUNKED_BATCH_FAILED;
+
+    return status;
+}
+
+/*
+ * _builtin_chunked - run a command over its arguments in batches that fit
+ * the kernel's argv limit, like xargs
+ *
+ * chunked [-P jobs] command [-option ... [--]] argument ...
+ *
+ * Leading options of the command are repeated in every batch; the
+ * arguments after them are split.  A batch the kernel still refuses with
+ * E2BIG is retried with a smaller budget.  With -P up to `jobs' batches
+ * run at once.
+ */
+static int _builtin_chunked(command_t *current_command, tree_t *tree)
+{
+    char **argv = current_command->argv, **batch;
+    const char *path;
+    int first = 1, fixed, next, i, count, jobs = 1, running = 0, oldest = 0;
+    int status = EXIT_SUCCESS, error;
+    size_t budget, fixed_bytes = 0, bytes, size;
+    pid_t *pids;
+
+    if (argv[first] != NULL && strcmp(argv[first], "-P") == 0
+        && argv[first + 1] != NULL) {
+        jobs = atoi(argv[first + 1]);
+        if (jobs < 1)  jobs = 1;
+        first += 2;
+    }
+    if (argv[first] == NULL) {
+        fprintf(stderr, "chunked: usage: chunked [-P jobs] command args...\n");
+        return EXIT_FAILURE;
+    }
+    path = argv[first];
+    if (strchr(path, '/') == NULL && (path = hash_lookup(path)) == NULL) {
+        fprintf(stderr, "psh: command not found.\n");
+        return 127;
+    }
+    for (fixed = first + 1; argv[fixed] != NULL && argv[fixed][0] == '-';
+         fixed++)
+        if (strcmp(argv[fixed], "--") == 0) { fixed++; break; }
+    for (next = first; next < fixed; next++)
+        fixed_bytes += strlen(argv[next]) + 1 + sizeof(char *);
+
+    // Leave headroom for the auxiliary vector and the like, as xargs does.
+    budget = arg_max_bytes() - current_command->envp_bytes
+        - CHUNKED_HEADROOM;
+    batch = (char **) arena_alloc(current_command->arena, sizeof(char *)
+                                  * (current_command->argc - first + 1));
+    pids = (pid_t *) arena_alloc(current_command->arena, sizeof(pid_t) * jobs);
+    memcpy(batch, argv + first, sizeof(char *) * (fixed - first));
+
+    for (next = fixed; ; next = i) {
+        count = fixed - first;
+        bytes = fixed_bytes;
+        for (i = next; i < current_command->argc; i++) {
+            size = strlen(argv[i]) + 1 + sizeof(char *);
+            if (count > fixed - first && bytes + size > budget)  break;
+            batch[count++] = argv[i];
+            bytes += size;
+        }
+        batch[count] = NULL;
+
+        if (running == jobs) {
+            status = _wait_batch(pids[oldest], status);
+            oldest = (oldest + 1) % jobs;
+            running--;
+        }
+        fflush(stdout);
+        error = posix_spawn(&pids[(oldest + running) % jobs], path, NULL, NULL,
+                            batch, current_command->envp);
+        if (error == E2BIG && count > fixed - first + 1) {
+            budget /= 2;  // the estimate was too generous
+            i = next;
+            continue;
         }
-        result = true;
-        break;
-    default:
-        result = false;
-        break;
+        if (error != 0) {
+            fprintf(stderr, "psh: %s: %s\n", argv[first], strerror(error));
+            status = (error == ENOENT) ? 127 : 126;
+            break;
+        }
+        running++;
+        if (i >= current_command->argc)  break;
+    }
+    for (; running > 0; running--) {
+        status = _wait_batch(pids[oldest], status);
+        oldest = (oldest + 1) % jobs;
     }
 
-    return result;
+    return status;
 }
 
 /*
- * _check_exit - check whether exit is in `current_command' and if so, do chdir
+ * _builtin_jobs - list the background jobs
  */
-static bool _check_exit(command_t *current_command, node_t *root)
+static int _builtin_jobs(command_t *current_command, tree_t *tree)
 {
-    bool result;
-    switch (strcmp(current_command->cmd, "exit")) {
-    case 0:
-        print_error("", root);
-        result = true;
-    default:
-        result = false;
-        break;
+    jobs_print(stdout);
+    return EXIT_SUCCESS;
+}
+
+/*
+ * _builtin_wait - wait for job %n, the job of pid n, or every job
+ */
+static int _builtin_wait(command_t *current_command, tree_t *tree)
+{
+    const char *id = current_command->argv[1];
+    int job, status;
+
+    if (id == NULL)
+        return job_wait(0);
+    if (id[0] == '%')
+        job = atoi(id + 1);
+    else
+        job = job_of_pid((pid_t) atoi(id));
+    if (job <= 0 || (status = job_wait(job)) == -1) {
+        fprintf(stderr, "wait: %s: no such job\n", id);
+        return 127;
     }
-    return result;
+
+    return status;
 }
 
+/*
+ * The output of one parallel job, collected until the job is done.
+ */
+typedef struct job_output {
+    char *data;
+    size_t length;
+    size_t capacity;
+    bool done;
+} job_output_t;
+
+typedef struct slot {
+    pid_t pid;
+    int fd;  // the job's stdout when grouped, else its pidfd
+    int index;  // which value the job was started for
+    int status;  // exit status of a job which never started
+} slot_t;
+
+/*
+ * _read_output - move whatever the job has written into its buffer
+ *
+ * Returns false at end of file.
+ */
+static bool _read_output(job_output_t *output, const int fd)
+{
+    ssize_t n;
+
+    if (output->length == output->capacity) {
+        output->capacity = (output->capacity == 0) ?
+            PARALLEL_BUFFER_SIZE : output->capacity * 2;
+        output->data = (char *) realloc(output->data, output->capacity);
+        if (output->data == NULL) {
+            fprintf(stderr, "Bad allocation (parallel) \n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    while ((n = read(fd, output->data + output->length,
+                     output->capacity - output->length)) == -1
+           && errno == EINTR)
+        ;
+    if (n <= 0)  return false;
+    output->length += n;
+
+    return true;
+}
+
+/*
+ * _flush_output - write a finished job's output in one piece
+ */
+static void _flush_output(job_output_t *output)
+{
+    fwrite(output->data, 1, output->length, stdout);
+    fflush(stdout);
+    free(output->data);
+    output->data = NULL;
+    output->length = output->capacity = 0;
+}
+
+/*
+ * _finish_job - reap the job in `slot' and report a failure
+ *
+ * Returns true when the job failed.
+ */
+static bool _finish_job(const slot_t *slot, const char *value)
+{
+    int wstatus, status = slot->status;
+
+    fd_close(slot->fd);
+    if (slot->pid != -1) {
+        while (waitpid(slot->pid, &wstatus, 0) == -1 && errno == EINTR)
+            ;
+        if (WIFSIGNALED(wstatus))
+            status = 128 + WTERMSIG(wstatus);
+        else
+            status = WEXITSTATUS(wstatus);
+    }
+    if (status != EXIT_SUCCESS)
+        fprintf(stderr, "parallel: %s: exit %d\n", value, status);
+
+    return status != EXIT_SUCCESS;
+}
+
+/*
+ * _builtin_parallel - run a command once for every value, a few at a time
+ *
+ * parallel [-j jobs] [-k] [-u] command [argument ...] ::: value ...
+ *
+ * Each job gets one value appended to the command.  Up to `jobs' (by
+ * default one per CPU) run at once, each taking a free slot as soon as
+ * another job is done.  A job's stdout is collected in a buffer of its
+ * own and written out in one piece when it is done, so lines of
+ * different jobs never interleave; the order is that of completion, or
+ * of the values with -k.  -u lets jobs write straight to stdout, and a
+ * pidfd then tells when one exits.
+ *
+ * Failed jobs are reported on stderr, and their number is the exit
+ * status.
+ */
+static int _builtin_parallel(command_t *current_command, tree_t *tree)
+{
+    char **argv = current_command->argv, **values;
+    int first = 1, separator, count, jobs, next, running = 0, emitted = 0;
+    int i, failed = 0;
+    bool keep_order = false, grouped = true, done;
+    job_output_t *outputs;
+    struct pollfd *fds;
+    command_t *job;
+    slot_t *slots, *slot;
+
+    jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    for (; argv[first] != NULL && argv[first][0] == '-'; first++) {
+        if (strcmp(argv[first], "-j") == 0 && argv[first + 1] != NULL)
+            jobs = atoi(argv[++first]);
+        else if (strcmp(argv[first], "-k") == 0)
+            keep_order = true;
+        else if (strcmp(argv[first], "-u") == 0)
+            grouped = false;
+        else
+            break;
+    }
+    for (separator = first; argv[separator] != NULL; separator++)
+        if (strcmp(argv[separator], ":::") == 0)  break;
+    if (separator == first || argv[separator] == NULL) {
+        fprintf(stderr, "parallel: usage: parallel [-j jobs] [-k] [-u] "
+                "command args... ::: values...\n");
+        return EXIT_FAILURE;
+    }
+    values = argv + separator + 1;
+    count = current_command->argc - separator - 1;
+    if (jobs < 1)  jobs = 1;
+
+    slots = (slot_t *) arena_alloc(tree->arena, sizeof(slot_t) * jobs);
+    fds = (struct pollfd *) arena_alloc(tree->arena,
+                                        sizeof(struct pollfd) * jobs);
+    outputs = (job_output_t *) arena_alloc(tree->arena,
+                                           sizeof(job_output_t) * count);
+    memset(outputs, 0, sizeof(job_output_t) * count);
+    fflush(stdout);
+
+    for (next = 0; next < count || running > 0; ) {
+        // Fill every free slot before waiting for anything.
+        for (; next < count && running < jobs; next++) {
+            job = init_command(tree);
+            for (i = first; i < separator; i++)
+                add_argument(job, argv[i]);
+            add_argument(job, values[next]);
+            slot = &(slots[running]);
+            slot->pid = start_command(job, grouped, tree);
+            slot->fd = grouped ? job->input_fd : fd_pidfd_open(slot->pid);
+            slot->index = next;
+            slot->status = job->status;
+            if (slot->fd == -1) {
+                // Nothing to poll: not started, or no pidfds here.
+                failed += _finish_job(slot, values[next]);
+                outputs[next].done = true;
+                continue;
+            }
+            fds[running].fd = slot->fd;
+            fds[running].events = POLLIN;
+            running++;
+        }
+
+        if (running > 0)
+            while (poll(fds, running, -1) == -1 && errno == EINTR)
+                ;
+        for (i = 0; i < running; i++) {
+            if (fds[i].revents == 0)  continue;
+            slot = &(slots[i]);
+            done = !grouped || !_read_output(&outputs[slot->index], slot->fd);
+            if (!done)  continue;
+            failed += _finish_job(slot, values[slot->index]);
+            outputs[slot->index].done = true;
+            if (grouped && !keep_order)
+                _flush_output(&outputs[slot->index]);
+            // Reaped in completion order; the last slot moves into this one.
+            running--;
+            slots[i] = slots[running];
+            fds[i] = fds[running];
+            i--;
+        }
+        if (grouped && keep_order)
+            for (; emitted < count && outputs[emitted].done; emitted++)
+                _flush_output(&outputs[emitted]);
+    }
+
+    return (failed > PARALLEL_FAILED_MAX) ? PARALLEL_FAILED_MAX : failed;
+}
 
 /**
- * check_builtins - check builtin commands
+ * find_builtin - get the builtin named `name', or NULL
+ * @name: command name
  */
-bool check_builtins(command_t *current_command, node_t * root)
+const builtin_t *find_builtin(const char *name)
 {
-    return _check_cd(current_command, root) ||
-        _check_exit(current_command, root);
+    const size_t length = strlen(name);
+    uint8_t index;
+
+    if (!builtin_slots_ready)  _init_builtin_slots();
+    index = builtin_slots[_builtin_slot(name, length)];
+    if (index == 0 || strcmp(builtins[index - 1].name, name) != 0)
+        return NULL;
+
+    return &(builtins[index - 1]);
 }
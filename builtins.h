@@ -10,11 +10,33 @@
 #ifndef PSH_BUILTINS_H_
 #define PSH_BUILTINS_H_
 
+#include <stdbool.h>
 #include <unistd.h>
 
 #include "executor.h"
 
-bool check_builtins(command_t *current_command, node_t * root);
+#define BUILTIN_SLOT_BITS  6
+#define BUILTIN_SLOTS      (1 << BUILTIN_SLOT_BITS)
 
-#endif   // PSH_BUILTINS_H_
+#define CHUNKED_HEADROOM      2048
+#define CHUNKED_BATCH_FAILED  123  // as xargs reports a failed invocation
+
+#define PARALLEL_BUFFER_SIZE  4096
+#define PARALLEL_FAILED_MAX   101  // more failures than GNU parallel counts
+
+typedef int (*builtin_func_t)(command_t *current_command, tree_t *tree);
+
+typedef struct builtin {
+    const char *name;
+    builtin_func_t run;
+    bool in_process;  // may run inside the shell when not in a pipeline
+    bool pure;  // leaves the shell alone, so may run inside for `...` too
+} builtin_t;
 
+/**
+ * find_builtin - get the builtin named `name', or NULL
+ * @name: command name
+ */
+const builtin_t *find_builtin(const char *name);
+
+#endif   // PSH_BUILTINS_H_
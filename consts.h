@@ -12,7 +12,8 @@
 
 #define PIPE_MAX  8
 #define ELEMENT_MAX  1024
-#define ARG_MAX  4096
-#define INPUT_MAX (4096*4)
+#define ARGV_INITIAL_SIZE  16
+#define WORD_BUFFER_SIZE  256
+#define SUBST_READ_SIZE  65536
 
 #endif  // PSH_CONSTS_H_
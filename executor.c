@@ -7,9 +7,14 @@
  * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
  */
 
+#define _GNU_SOURCE
+
+#include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
@@ -19,410 +24,1170 @@
 
 #include "builtins.h"
 #include "executor.h"
+#include "fd.h"
+#include "hash.h"
+#include "jobs.h"
+#include "vars.h"
 
 
-static void _init_redirect_in_stream(node_t *current);
-static void _init_redirect_out_stream(node_t *current);
-static void _init_redirection_stream(node_t *current);
-static int _fork_exec(command_t *current_command,
-                      const bool head_flag, const bool tail_flag, node_t *root);
+static void _add_spawn_redirects(posix_spawn_file_actions_t *actions,
+                                 const command_t *current_command);
+static bool _fits_arg_max(const command_t *current_command);
+static int _apply_redirects(const command_t *current_command);
+static pid_t _spawn_exec(command_t *current_command, const bool head_flag,
+                         const bool tail_flag, const int next_pipe[2]);
+static pid_t _fork_child(const builtin_t *builtin, command_t *current_command,
+                         const bool head_flag, const bool tail_flag,
+                         const int next_pipe[2], tree_t *tree);
+static void _start_fanouts(command_t *current_command, const int pipe_sink,
+                           tree_t *tree);
+static void _add_substs(command_t *current_command, const pid_t *pids,
+                        const int count);
+static void _settle_assignments(command_t *current_command);
+static void _run_captured(const builtin_t *builtin,
+                          command_t *current_command, tree_t *tree);
+static pid_t _fork_exec(command_t *current_command,
+                        const bool head_flag, const bool tail_flag, tree_t *tree);
 static void _eat_letter(const node_t *current,
-                        command_t *current_command, node_t *parent, node_t *root);
+                        command_t *current_command, tree_t *tree);
 static void _eat_num(const node_t *current,
-                     command_t *current_command, node_t *parent, node_t *root);
+                     command_t *current_command, tree_t *tree);
 static void _eat_alphanum(const node_t *current,
-                          command_t *current_command, node_t *parent, node_t *root);
+                          command_t *current_command, tree_t *tree);
 static void _eat_home(const node_t *current,
-                      command_t *current_command, node_t *parent, node_t *root);
+                      command_t *current_command, tree_t *tree);
 static void _eat_env(const node_t *current,
-                     command_t *current_command, node_t *parent, node_t *root);
-static void _eat_word(node_t *current, command_t *current_command, bool fstflag, node_t *root);
+                     command_t *current_command, tree_t *tree);
+static void _eat_subst(const node_t *current,
+                       command_t *current_command, tree_t *tree);
+static void _eat_proc_subst(const node_t *current,
+                            command_t *current_command, tree_t *tree);
+static void _eat_word(const node_t *current, command_t *current_command,
+                      tree_t *tree);
 static void _eat_env_assignment(const node_t *current,
-                                command_t *current_command, node_t *root);
+                                command_t *current_command, tree_t *tree);
+static redirect_t *_add_redirect(command_t *current_command,
+                                 const redirect_kind_t kind, const int fd);
+static void _detach_stdin(command_t *current_command);
 static void _eat_redirection_out(node_t *current, command_t *current_command,
-                                 node_t *root);
+                                 tree_t *tree);
+static void _eat_heredoc(node_t *current, command_t *current_command,
+                         const int fd, tree_t *tree);
 static void _eat_redirection_in(node_t *current, command_t *current_command,
-                                node_t *root);
+                                tree_t *tree);
 static void _eat_redirection(const node_t *current, command_t *current_command,
-                             node_t *root);
+                             tree_t *tree);
 static void _eat_redirection_list(const node_t *current,
-                                  command_t *current_command, node_t *root);
+                                  command_t *current_command, tree_t *tree);
 static void _eat_command_element(const node_t *current,
-                                 command_t *current_command, node_t *root);
+                                 command_t *current_command, tree_t *tree);
 static void _eat_command(const node_t *current, command_t *current_command,
-                         node_t *root);;
-static void _eat_piped_command(const node_t *current,
-                               command_t *current_command, const bool head,
-                               node_t *root);
+                         tree_t *tree);;
+static int _start_pipeline(const node_t *current, command_t *current_command,
+                           tree_t *tree, pid_t **pids_ptr);
+static int _eat_piped_command(const node_t *current,
+                              command_t *current_command, tree_t *tree);
 /**
  * print_error - print error message and finalize program
  */
-void print_error(const char *error_message, node_t *root)
+void print_error(const char *error_message, tree_t *tree)
 {
-    fprintf(stderr, error_message);
-    free_nodes(root, root);
+    fprintf(stderr, "%s", error_message);
     exit(EXIT_FAILURE);
 }
 
 /*
- * _fork_exec - fork and exec
+ * _add_spawn_redirects - turn the redirections into spawn file actions
+ *
+ * The files are opened by the child itself.  They are opened without
+ * O_CLOEXEC because the opened descriptor may already be the target one.
  */
-static int _fork_exec(command_t *current_command,
-                      const bool head_flag, const bool tail_flag, node_t *root)
+static void _add_spawn_redirects(posix_spawn_file_actions_t *actions,
+                                 const command_t *current_command)
 {
-    pid_t fork_result, child;
-    int next_pipe[2];
+    const redirect_t *redirect;
 
-    if (pipe(next_pipe) == 0) {
-        fork_result = fork();
-        switch (fork_result) {
-        case -1:
-            print_error("fork failure", root);
-            break;
-        case 0:  // case of child
-            if (!head_flag) {
-                dup2(current_command->input_fd, STDIN_FILENO);
-                close(current_command->input_fd);
-            }            
-            if (tail_flag) {
-                close(next_pipe[1]);
-                current_command->output_fd = open("/dev/stdout", O_WRONLY);
-            } else {
-                current_command->output_fd = next_pipe[1];
-            }
-            dup2(current_command->output_fd, STDOUT_FILENO);
-            close(current_command->output_fd);
-            if (!check_builtins(current_command, root)) {
-                execvp(current_command->cmd, current_command->argv);
-                print_error("psh: command not found.\n", root);
+    for (redirect = current_command->redirects; redirect != NULL;
+         redirect = redirect->next) {
+        if (redirect->kind == REDIRECT_ACTION_OPEN)
+            posix_spawn_file_actions_addopen(actions, redirect->fd,
+                                             redirect->path, redirect->flags,
+                                             0666);
+        else
+            posix_spawn_file_actions_adddup2(actions, redirect->source_fd,
+                                             redirect->fd);
+    }
+}
+
+/*
+ * _first_private - get the lowest descriptor a child may close
+ *
+ * Descriptors are closed only after the redirections have run, since
+ * those may read from private ones, and above every one they set up.
+ */
+static int _first_private(const command_t *current_command)
+{
+    const redirect_t *redirect;
+    int first = FD_FIRST_PRIVATE;
+
+    for (redirect = current_command->redirects; redirect != NULL;
+         redirect = redirect->next)
+        if (redirect->fd >= first)
+            first = redirect->fd + 1;
+
+    return first;
+}
+
+/*
+ * _close_data - close the descriptors holding here-document bodies
+ */
+static void _close_data(const command_t *current_command)
+{
+    const redirect_t *redirect;
+
+    for (redirect = current_command->redirects; redirect != NULL;
+         redirect = redirect->next)
+        if (redirect->kind == REDIRECT_ACTION_DATA)
+            fd_close(redirect->source_fd);
+}
+
+/*
+ * _apply_redirects - carry out the redirections in a forked child
+ */
+static int _apply_redirects(const command_t *current_command)
+{
+    const redirect_t *redirect;
+    int fd;
+
+    for (redirect = current_command->redirects; redirect != NULL;
+         redirect = redirect->next) {
+        if (redirect->kind != REDIRECT_ACTION_OPEN) {
+            if (dup2(redirect->source_fd, redirect->fd) == -1) {
+                fprintf(stderr, "psh: %d: %s\n", redirect->source_fd,
+                        strerror(errno));
+                return -1;
             }
-            _exit(EXIT_SUCCESS);
-            break;
-        default:  // case of parent
-            close(next_pipe[1]);
-            child = wait(NULL);
-            check_builtins(current_command, root);
-            if (!tail_flag)
-                current_command->input_fd = next_pipe[0];
-            break;
+            // dup2 onto itself keeps close-on-exec, unlike the spawn action.
+            if (redirect->source_fd == redirect->fd)
+                fcntl(redirect->fd, F_SETFD, 0);
+            continue;
+        }
+        fd = open(redirect->path, redirect->flags | O_CLOEXEC, 0666);
+        if (fd == -1) {
+            fprintf(stderr, "psh: %s: %s\n", redirect->path, strerror(errno));
+            return -1;
+        }
+        if (fd == redirect->fd) {
+            fcntl(fd, F_SETFD, 0);
+        } else {
+            dup2(fd, redirect->fd);
+            close(fd);
         }
-        
-    } else {
-        print_error("psh: pipe creation failure", root);
     }
 
     return 0;
 }
 
 /*
- * _init_redirect_in_stream - initialize stream binded by redirect in
+ * _exec_in_place - replace the shell with the final command of a script
+ *
+ * Returns only when the command could not be run.
  */
-static void _init_redirect_in_stream(node_t *current) {
-    node_t *word = current->left;
-    FILE *stream;
-    int streamfd;
-    const char *streamname = word->token->element;
-    if (!_is_abstract_node(current)) {
-        stream = fopen(streamname, "r");
-    } else {
-        stream = stdin;
+static void _exec_in_place(command_t *current_command)
+{
+    const char *path = current_command->cmd;
+
+    if (!_fits_arg_max(current_command)) {
+        current_command->status = 126;
+        return;
+    }
+    if (strchr(path, '/') == NULL
+        && (path = hash_lookup(current_command->cmd)) == NULL) {
+        fprintf(stderr, "psh: command not found.\n");
+        current_command->status = 127;
+        return;
+    }
+    if (_apply_redirects(current_command) != 0) {
+        current_command->status = EXIT_FAILURE;
+        return;
     }
-    streamfd = fileno(stream);
-    dup2(current->oldstreamfd, streamfd);
-    close(current->oldstreamfd);
+    fflush(NULL);
+    execve(path, current_command->argv, current_command->envp);
+    fprintf(stderr, "psh: %s: %s\n", current_command->cmd, strerror(errno));
+    current_command->status = (errno == ENOENT) ? 127 : 126;
 }
 
 /*
- * _init_redirect_out_stream - initialize stream binded by redirect out
+ * _spawn_exec - start an external command through posix_spawn
+ *
+ * posix_spawn lets libc use vfork/CLONE_VM, so starting a command costs
+ * the same however large the shell's own address space has grown.  The
+ * command is looked up through the hash table rather than letting
+ * posix_spawnp walk $PATH again on every run.
  */
-static void _init_redirect_out_stream(node_t *current) {
-    node_t *word = current->left;
-    FILE *stream;
-    int streamfd;
-    char *mode;
-    const char *streamname = current->token->element;
-    switch (current->token->spec) {
-    case REDIRECT_OUT: case REDIRECT_OUT_COMPOSITION:
-        mode = "w";
+static pid_t _spawn_exec(command_t *current_command, const bool head_flag,
+                         const bool tail_flag, const int next_pipe[2])
+{
+    posix_spawn_file_actions_t actions;
+    const char *path = current_command->cmd;
+    const bool hashed = (strchr(path, '/') == NULL);
+    pid_t child;
+    int error;
+
+    if (!_fits_arg_max(current_command)) {
+        current_command->status = 126;
+        return -1;
+    }
+    if (hashed && (path = hash_lookup(current_command->cmd)) == NULL) {
+        fprintf(stderr, "psh: command not found.\n");
+        current_command->status = 127;
+        return -1;
+    }
+
+    // Pipe ends are close-on-exec, so only the dup2'ed copies survive.
+    posix_spawn_file_actions_init(&actions);
+    if (!head_flag)
+        posix_spawn_file_actions_adddup2(&actions, current_command->input_fd,
+                                         STDIN_FILENO);
+    if (!tail_flag)
+        posix_spawn_file_actions_adddup2(&actions, next_pipe[1], STDOUT_FILENO);
+    else if (current_command->output_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, current_command->output_fd,
+                                         STDOUT_FILENO);
+    _add_spawn_redirects(&actions, current_command);
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 34)
+    posix_spawn_file_actions_addclosefrom_np(&actions,
+                                             _first_private(current_command));
+#endif
+    error = posix_spawn(&child, path, &actions, NULL,
+                        current_command->argv, current_command->envp);
+    if (error == ENOENT && hashed && access(path, X_OK) != 0) {
+        // The remembered file has gone away; search $PATH once more.
+        hash_forget(current_command->cmd);
+        path = hash_lookup(current_command->cmd);
+        if (path != NULL)
+            error = posix_spawn(&child, path, &actions, NULL,
+                                current_command->argv, current_command->envp);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0) {
+        fprintf(stderr, "psh: %s: %s\n", current_command->cmd,
+                strerror(error));
+        current_command->status = (error == ENOENT) ? 127 : 126;
+        return -1;
+    }
+
+    return child;
+}
+
+/*
+ * _fork_child - fork a child which runs a builtin inside of the pipeline
+ */
+static pid_t _fork_child(const builtin_t *builtin, command_t *current_command,
+                         const bool head_flag, const bool tail_flag,
+                         const int next_pipe[2], tree_t *tree)
+{
+    pid_t child = fork();
+    int status;
+
+    switch (child) {
+    case -1:
+        print_error("fork failure", tree);
         break;
-    case REDIRECT_OUT_APPEND:
-        mode = "a";
+    case 0:  // case of child
+        if (!head_flag)
+            dup2(current_command->input_fd, STDIN_FILENO);
+        if (!tail_flag)
+            dup2(next_pipe[1], STDOUT_FILENO);
+        else if (current_command->output_fd != -1)
+            dup2(current_command->output_fd, STDOUT_FILENO);
+        if (_apply_redirects(current_command) != 0)
+            _exit(EXIT_FAILURE);
+        fd_close_private(_first_private(current_command));
+        status = builtin->run(current_command, tree);
+        fflush(stdout);
+        _exit(status);
         break;
     default:
         break;
     }
-    if (current->token->spec == REDIRECT_OUT_COMPOSITION) {
-        if (!_is_abstract_node(current)) {
-            streamfd = atoi(streamname);;
-        } else {
-            streamfd = STDOUT_FILENO;
+
+    return child;
+}
+
+/*
+ * _run_captured - run a builtin inside the shell, printing into memory
+ *
+ * stdout is swapped for a memory stream for the duration, so the output
+ * of `echo` in `...` never goes through a pipe or another process.
+ */
+static void _run_captured(const builtin_t *builtin,
+                          command_t *current_command, tree_t *tree)
+{
+    FILE *saved = stdout;
+
+    stdout = open_memstream(&(current_command->captured),
+                            &(current_command->captured_length));
+    if (stdout == NULL) {
+        fprintf(stderr, "Bad allocation (executor) \n");
+        exit(EXIT_FAILURE);
+    }
+    current_command->status = builtin->run(current_command, tree);
+    fclose(stdout);
+    stdout = saved;
+}
+
+/*
+ * _is_output - check whether `redirect' opens a file for writing
+ */
+static inline bool _is_output(const redirect_t *redirect)
+{
+    return redirect->kind == REDIRECT_ACTION_OPEN
+        && (redirect->flags & O_ACCMODE) == O_WRONLY;
+}
+
+/*
+ * _run_fanout - copy the fan-out pipe to every target of `first''s fd
+ *
+ * Runs in the forked fan-out process and never returns.
+ */
+static void _run_fanout(const redirect_t *first, const int in,
+                        const int pipe_sink)
+{
+    const redirect_t *redirect;
+    int *sinks, count = 0, fd;
+
+    signal(SIGPIPE, SIG_IGN);  // a sink which goes away is only dropped
+    dup2(in, STDIN_FILENO);
+    if (pipe_sink != -1)
+        dup2(pipe_sink, STDOUT_FILENO);
+    fd_close_private(FD_FIRST_PRIVATE);
+
+    for (redirect = first; redirect != NULL; redirect = redirect->next)
+        count++;
+    sinks = (int *) malloc(sizeof(int) * (count + 1));
+    if (sinks == NULL) {
+        fprintf(stderr, "Bad allocation (executor) \n");
+        _exit(EXIT_FAILURE);
+    }
+    count = 0;
+    if (pipe_sink != -1)
+        sinks[count++] = STDOUT_FILENO;
+    for (redirect = first; redirect != NULL; redirect = redirect->next) {
+        if (!_is_output(redirect) || redirect->fd != first->fd)  continue;
+        fd = open(redirect->path, redirect->flags | O_CLOEXEC, 0666);
+        if (fd == -1)
+            fprintf(stderr, "psh: %s: %s\n", redirect->path, strerror(errno));
+        else
+            sinks[count++] = fd;
+    }
+    _exit(fd_fanout(STDIN_FILENO, sinks, count) == 0 ?
+          EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/*
+ * _start_fanouts - send a descriptor written to more than once to all targets
+ *
+ * Like zsh's multios, `cmd > a > b | c` writes to a, b and c alike.  For
+ * each such descriptor a forked fan-out process is put in between: the
+ * command writes into a pipe, and the process tees the pipe into every
+ * file and into the next stage's pipe, which `pipe_sink' is the write end
+ * of, or -1 for the last stage.  The first redirection becomes the pipe
+ * and the rest are dropped; the process is reaped with the line, so a
+ * command with one is never exec'd in place of the shell.
+ */
+static void _start_fanouts(command_t *current_command, const int pipe_sink,
+                           tree_t *tree)
+{
+    redirect_t *first, *redirect, *prev;
+    int fanout_pipe[2], targets;
+    pid_t child;
+
+    for (first = current_command->redirects; first != NULL;
+         first = first->next) {
+        if (!_is_output(first))  continue;
+        targets = (first->fd == STDOUT_FILENO && pipe_sink != -1) ? 1 : 0;
+        for (redirect = first; redirect != NULL; redirect = redirect->next)
+            if (_is_output(redirect) && redirect->fd == first->fd)
+                targets++;
+        if (targets < 2)  continue;
+
+        if (fd_pipe(fanout_pipe) != 0)
+            print_error("psh: pipe creation failure", tree);
+        child = fork();
+        if (child == -1)
+            print_error("fork failure", tree);
+        if (child == 0) {
+            close(fanout_pipe[1]);
+            _run_fanout(first, fanout_pipe[0],
+                        (first->fd == STDOUT_FILENO) ? pipe_sink : -1);
         }
-    } else {
-        if (!_is_abstract_node(current)) {
-            streamfd = atoi(streamname);
-            stream = fdopen(streamfd, mode);
-        } else {
-            stream = stdout;
+        fd_close(fanout_pipe[0]);
+        _add_substs(current_command, &child, 1);
+
+        for (prev = first; (redirect = prev->next) != NULL; ) {
+            if (!_is_output(redirect) || redirect->fd != first->fd) {
+                prev = redirect;
+                continue;
+            }
+            prev->next = redirect->next;
+            if (current_command->last_redirect == redirect)
+                current_command->last_redirect = prev;
         }
-        streamfd = fileno(stream);
+        first->kind = REDIRECT_ACTION_DATA;
+        first->source_fd = fanout_pipe[1];
     }
-    dup2(current->oldstreamfd, streamfd);
-    close(current->oldstreamfd);
 }
 
 /*
- * _init_redirection_stream - initialize stream
+ * _is_assigned - check whether one of `assignments' sets the name of `pair'
  */
-static void _init_redirection_stream(node_t *current) {
-    node_t *left, *right;
-    
-    if (_is_redirect_in(current->token))
-        _init_redirect_in_stream(current);
+static bool _is_assigned(const assignment_t *assignments, const char *pair)
+{
+    const assignment_t *assignment;
+
+    for (assignment = assignments; assignment != NULL;
+         assignment = assignment->next)
+        if (strncmp(pair, assignment->pair, assignment->name_length + 1) == 0)
+            return true;
+    return false;
+}
+
+/*
+ * _settle_assignments - give effect to NAME=value before the command name
+ *
+ * With no command to run they set shell variables.  Otherwise they go
+ * only into the command's own environment, over the exported variables,
+ * as in `CC=gcc make'.
+ */
+static void _settle_assignments(command_t *current_command)
+{
+    const assignment_t *assignment;
+    char **shell_envp = var_envp();
+    char **envp;
+    size_t count = 0, bytes = sizeof(char *);
+    int i;
+
+    current_command->envp = shell_envp;
+    current_command->envp_bytes = var_envp_bytes();
+    if (current_command->assignments == NULL)  return;
+    if (current_command->argc == 0) {
+        // The store copies the text, which lives only as long as the line.
+        for (assignment = current_command->assignments; assignment != NULL;
+             assignment = assignment->next)
+            var_set(assignment->pair, assignment->name_length,
+                    assignment->pair + assignment->name_length + 1, false);
+        return;
+    }
+
+    for (i = 0; shell_envp[i] != NULL; i++)  count++;
+    for (assignment = current_command->assignments; assignment != NULL;
+         assignment = assignment->next)
+        count++;
+    envp = (char **) arena_alloc(current_command->arena,
+                                 sizeof(char *) * (count + 1));
+    count = 0;
+    for (i = 0; shell_envp[i] != NULL; i++) {
+        if (_is_assigned(current_command->assignments, shell_envp[i]))
+            continue;
+        envp[count++] = shell_envp[i];
+        bytes += strlen(shell_envp[i]) + 1 + sizeof(char *);
+    }
+    for (assignment = current_command->assignments; assignment != NULL;
+         assignment = assignment->next) {
+        if (_is_assigned(assignment->next, assignment->pair))
+            continue;  // a later one for the same name wins
+        envp[count++] = (char *) assignment->pair;
+        bytes += strlen(assignment->pair) + 1 + sizeof(char *);
+    }
+    envp[count] = NULL;
+    current_command->envp = envp;
+    current_command->envp_bytes = bytes;
+}
+
+/*
+ * _fork_exec - start one stage of a pipeline without waiting for it
+ *
+ * External commands are spawned.  A builtin standing alone runs inside
+ * the shell itself when its table entry allows it; inside a pipeline it
+ * runs in a forked child like any other stage.  The last stage writes to
+ * the shell's own stdout and therefore needs no pipe, unless its output
+ * is captured and it does not run inside the shell.
+ */
+static pid_t _fork_exec(command_t *current_command,
+                        const bool head_flag, const bool tail_flag, tree_t *tree)
+{
+    const builtin_t *builtin = NULL;
+    pid_t child;
+    int next_pipe[2] = { -1, -1 };
 
-    if (_is_redirect_out(current->token))
-        _init_redirect_out_stream(current);
+    if (current_command->argc != 0)
+        builtin = find_builtin(current_command->cmd);
+    _settle_assignments(current_command);
+    if (!tail_flag && fd_pipe(next_pipe) != 0)
+        print_error("psh: pipe creation failure", tree);
+    _start_fanouts(current_command, next_pipe[1], tree);
 
-    if (current->left != NULL) {
-        left = (node_t *)current->left;
-        _init_redirection_stream(left);
+    // The shell's own descriptors are never redirected, so a builtin with
+    // redirections runs in a child like an external command.  So does one
+    // in the background, which the shell must not wait for, and one whose
+    // output is captured unless it leaves the shell's state alone.
+    if (builtin != NULL && builtin->in_process && head_flag && tail_flag
+        && current_command->redirects == NULL && !current_command->background
+        && (!current_command->capture || builtin->pure)) {
+        if (!current_command->capture) {
+            current_command->status = builtin->run(current_command, tree);
+            fflush(stdout);
+        } else {
+            _run_captured(builtin, current_command, tree);
+        }
+        return -1;
     }
-    if (current->right != NULL) {
-        right = (node_t *)current->right;
-        _init_redirection_stream(right);
+    // Only now is it known that captured output must go through a pipe.
+    if (tail_flag && current_command->capture) {
+        if (fd_pipe(next_pipe) != 0)
+            print_error("psh: pipe creation failure", tree);
+        current_command->output_fd = next_pipe[1];
     }
+
+    // Nothing is left to run after the final command of a script, so the
+    // shell can become that command instead of waiting for a child.  It
+    // cannot while substituted processes are still its to reap.
+    if (builtin == NULL && current_command->argc != 0
+        && current_command->exec_flag && !current_command->background
+        && head_flag && tail_flag && current_command->subst_count == 0) {
+        _exec_in_place(current_command);
+        _close_data(current_command);
+        return -1;
+    }
+
+    current_command->status = EXIT_SUCCESS;
+    if (current_command->argc == 0)
+        child = -1;  // only assignments or redirections
+    else if (builtin != NULL)
+        child = _fork_child(builtin, current_command, head_flag, tail_flag,
+                            next_pipe, tree);
+    else
+        child = _spawn_exec(current_command, head_flag, tail_flag, next_pipe);
+
+    // case of parent
+    _close_data(current_command);
+    if (next_pipe[1] != -1)
+        fd_close(next_pipe[1]);
+    if (!head_flag)
+        fd_close(current_command->input_fd);
+    if (next_pipe[0] != -1)
+        current_command->input_fd = next_pipe[0];
+
+    return child;
 }
 
+/**
+ * start_command - start `command' in a child of its own without waiting
+ * @current_command: command whose argv has been filled in
+ * @capture: send its stdout into a new pipe rather than the shell's
+ * @tree: tree whose arena holds the command
+ *
+ * The command takes the same path as a pipeline stage, reading
+ * /dev/null.  When capturing, the read end of the pipe is left in
+ * input_fd even if the command could not be started.  Returns the pid,
+ * or -1 with the status set.
+ */
+pid_t start_command(command_t *current_command, const bool capture,
+                    tree_t *tree)
+{
+    current_command->background = true;
+    current_command->exec_flag = false;
+    _detach_stdin(current_command);
+    return _fork_exec(current_command, true, !capture, tree);
+}
+
+/*
+ * _wait_pipeline - reap every stage of a pipeline by its pid
+ *
+ * Returns the exit status of the last stage, or `status' when the last
+ * stage never became a process.
+ */
+static int _wait_pipeline(const pid_t *pids, const int count, int status)
+{
+    int i, wstatus;
+
+    for (i = 0; i < count; i++) {
+        if (pids[i] == -1)  continue;
+        while (waitpid(pids[i], &wstatus, 0) == -1 && errno == EINTR)
+            ;
+        if (i != count - 1)  continue;
+        if (WIFEXITED(wstatus))
+            status = WEXITSTATUS(wstatus);
+        else if (WIFSIGNALED(wstatus))
+            status = 128 + WTERMSIG(wstatus);
+    }
+
+    return status;
+}
+
+/*
+ * _begin_word - start a new word at the end of the expansion buffer
+ */
+static inline void _begin_word(command_t *current_command)
+{
+    current_command->words.start = current_command->words.length;
+}
+
+/*
+ * _reserve_text - make room for `length' more characters and a NUL
+ *
+ * When the buffer is full only the unfinished word moves to a larger one;
+ * finished words stay where argv already points at them.
+ */
+static void _reserve_text(command_t *current_command, const size_t length)
+{
+    word_buffer_t *words = &(current_command->words);
+    const size_t word_length = words->length - words->start;
+    size_t capacity;
+    char *data;
+
+    if (words->length + length + 1 > words->capacity) {
+        capacity = (words->capacity == 0) ? WORD_BUFFER_SIZE : words->capacity;
+        while (capacity < word_length + length + 1)
+            capacity *= 2;
+        data = (char *) arena_alloc(current_command->arena, capacity);
+        memcpy(data, words->data + words->start, word_length);
+        words->data = data;
+        words->capacity = capacity;
+        words->start = 0;
+        words->length = word_length;
+    }
+}
+
+/*
+ * _append_text - append `length' characters of `s' to the word being built
+ */
+static void _append_text(command_t *current_command, const char *s,
+                         const size_t length)
+{
+    word_buffer_t *words = &(current_command->words);
+
+    _reserve_text(current_command, length);
+    memcpy(words->data + words->length, s, length);
+    words->length += length;
+}
+
+/*
+ * _end_word - terminate the word being built and return it
+ */
+static const char *_end_word(command_t *current_command)
+{
+    word_buffer_t *words = &(current_command->words);
+
+    _append_text(current_command, "", 0);  // makes room for the NUL
+    words->data[words->length++] = '\0';
+
+    return words->data + words->start;
+}
 
 /*
  * _eat_terminal - eat <letter>, <num> or <alphanum>
  */
 static inline void __eat_terminal(const node_t *current,
-                                  command_t *current_command, node_t *parent,
-                                  node_t *root) {
-    strncat(parent->token->element,
-            current->token->element, strlen(current->token->element));
+                                  command_t *current_command, tree_t *tree) {
+    const str_t *text = current->text;
+
+    if (text != NULL)
+        _append_text(current_command, text->data, text->length);
 }
 
 /*
  * _eat_letter - eat <letter>
  */
 static void _eat_letter(const node_t *current,
-                        command_t *current_command, node_t *parent,
-                        node_t *root) {
-    __eat_terminal(current, current_command, parent, root);
+                        command_t *current_command, tree_t *tree) {
+    __eat_terminal(current, current_command, tree);
 }
 
 /*
  * _eat_num - eat <num>
  */
 static void _eat_num(const node_t *current,
-                     command_t *current_command, node_t *parent,
-                     node_t *root) {
-    __eat_terminal(current, current_command, parent, root);
-    
+                     command_t *current_command, tree_t *tree) {
+    __eat_terminal(current, current_command, tree);
 }
 
 /*
  * _eat_alphanum - eat <alphanum>
  */
 static void _eat_alphanum(const node_t *current,
-                          command_t *current_command, node_t *parent,
-                          node_t *root) {
-    __eat_terminal(current, current_command, parent, root);
+                          command_t *current_command, tree_t *tree) {
+    __eat_terminal(current, current_command, tree);
 }
 
 /*
  * _eat_home - eat <home>
  */
 static void _eat_home(const node_t *current,
-                      command_t *current_command, node_t *parent,
-                      node_t *root) {
-    const node_t *home = current;
-    const char *word;
+                      command_t *current_command, tree_t *tree) {
+    const char *word = var_get("HOME");
 
-    word = getenv("HOME");
-    if (_is_word(parent->token)) {
-        strncat(parent->token->element, word, strlen(word));
-    } else {
-        print_error("cannot eat home.", root);
-    }
+    if (word != NULL)
+        _append_text(current_command, word, strlen(word));
 }
 
 /*
  * _eat_env - eat <env>
  */
 static void _eat_env(const node_t *current,
-                     command_t *current_command, node_t *parent,
-                     node_t *root) {
-    const node_t *env = current;
-    const char *word;
+                     command_t *current_command, tree_t *tree) {
+    const char *word = var_get(_node_text(current));
 
-    word = getenv(env->token->element);
-    if (word == NULL)  return;
-    if (_is_word(parent->token)) {
-        strncat(parent->token->element, word, strlen(word));
-    } else {
-        fprintf(stderr,"psh: error: cannot eat env %s\n", env->token->element);
+    if (word != NULL)
+        _append_text(current_command, word, strlen(word));
+}
+
+/*
+ * _parse_subst_text - parse the command held in the text of `current'
+ */
+static tree_t *_parse_subst_text(const node_t *current, const bool background,
+                                 tree_t *tree)
+{
+    tree_t *subtree =
+        parse_input(init_parser(tree->arena),
+                    init_tokenizer_slice(tree->arena, current->text->data,
+                                         current->text->length));
+
+    subtree->background = background;
+    return subtree;
+}
+
+/*
+ * _add_substs - remember `count' processes to be reaped with the line
+ */
+static void _add_substs(command_t *current_command, const pid_t *pids,
+                        const int count)
+{
+    pid_t *substs;
+    int capacity;
+
+    if (count <= 0)  return;
+    if (current_command->subst_count + count
+        > current_command->subst_capacity) {
+        capacity = current_command->subst_capacity * 2;
+        if (capacity < current_command->subst_count + count)
+            capacity = current_command->subst_count + count;
+        substs = (pid_t *) arena_alloc(current_command->arena,
+                                       sizeof(pid_t) * capacity);
+        if (current_command->subst_count > 0)
+            memcpy(substs, current_command->substs,
+                   sizeof(pid_t) * current_command->subst_count);
+        current_command->substs = substs;
+        current_command->subst_capacity = capacity;
     }
+    memcpy(current_command->substs + current_command->subst_count, pids,
+           sizeof(pid_t) * count);
+    current_command->subst_count += count;
 }
 
 /*
- * _eat_word - eat <word>
+ * _eat_subst - eat <subst>, splicing the output of the command into the word
+ *
+ * The command is parsed from the node's text and started with its last
+ * stage writing into a pipe, which is read straight into the word buffer
+ * in large chunks; no temporary file is involved.  A lone pure builtin
+ * runs inside the shell and prints into memory instead, with no fork,
+ * pipe or read buffer at all.  Trailing newlines are dropped.
  */
-static void _eat_word(node_t *current, command_t *current_command,
-                      bool fstflag, node_t *root) {
-    const node_t *elh = current->left;  // container_of(&(current->head->left), node_t, head);
-    node_t *word = current->right;  // container_of(&(current->head->right), node_t, head);
+static void _eat_subst(const node_t *current,
+                       command_t *current_command, tree_t *tree) {
+    word_buffer_t *words = &(current_command->words);
+    const size_t prefix = words->length - words->start;
+    command_t *inner;
+    tree_t *subtree;
+    pid_t *pids;
+    int stages;
+    ssize_t n;
 
-    if (elh == NULL)  return;
-    switch (elh->token->spec) {
-    case ENV: case ENV_WORD:
-        _eat_env(elh, current_command, current, root);
-        break;
-    case LETTER:
-        _eat_letter(elh, current_command, current, root);
-        break;
-    case ALPHANUM:
-        _eat_alphanum(elh, current_command, current, root);
-        break;
-    case NUM:
-        _eat_num(elh, current_command, current, root);
-        break;
-    case HOME: case HOME_WORD:
-        _eat_home(elh, current_command, current, root);
-        break;
-    default:
-        break;
+    if (current->text == NULL)  return;
+    subtree = _parse_subst_text(current, false, tree);
+    inner = init_command(subtree);
+    inner->capture = true;
+    stages = _start_pipeline(tree_node(subtree, subtree->root), inner,
+                             subtree, &pids);
+
+    if (inner->captured != NULL) {
+        _append_text(current_command, inner->captured, inner->captured_length);
+        free(inner->captured);
+    } else if (stages > 0) {
+        for (;;) {
+            _reserve_text(current_command, SUBST_READ_SIZE);
+            n = read(inner->input_fd, words->data + words->length,
+                     words->capacity - words->length - 1);
+            if (n > 0)
+                words->length += n;
+            else if (n == 0 || errno != EINTR)
+                break;
+        }
+        fd_close(inner->input_fd);
+        _wait_pipeline(pids, stages, inner->status);
     }
-    
-    if (word != NULL && _is_word(word->token)) {
-        _eat_word(word, current_command, false, root);
-        strncat(current->token->element,
-                word->token->element, strlen(word->token->element));
+    _wait_pipeline(inner->substs, inner->subst_count, EXIT_SUCCESS);
+
+    while (words->length - words->start > prefix
+           && words->data[words->length - 1] == '\n')
+        words->length--;
+}
+
+/*
+ * _eat_proc_subst - eat <proc_subst>, naming a pipe to the command as /dev/fd/N
+ *
+ * The command is started at once with one end of a pipe as its stdout,
+ * for "<(", or its stdin, for ">(", and runs side by side with the outer
+ * command, which gets the other end.  Nothing is buffered by the shell
+ * and nothing touches the disk.  Like a job, the command is never run
+ * inside the shell and reads /dev/null unless it reads the pipe; its
+ * processes are reaped once the outer pipeline is done.
+ */
+static void _eat_proc_subst(const node_t *current,
+                            command_t *current_command, tree_t *tree) {
+    const bool in = (current->spec == PROC_SUBST_IN
+                     || current->spec == PROC_SUBST_IN_WORD);
+    command_t *inner;
+    tree_t *subtree;
+    redirect_t *redirect;
+    pid_t *pids = NULL;
+    int stages, subst_pipe[2], keep;
+    char path[32];
+
+    if (current->text == NULL)  return;
+    subtree = _parse_subst_text(current, true, tree);
+    inner = init_command(subtree);
+    if (fd_pipe(subst_pipe) != 0)
+        print_error("psh: pipe creation failure", tree);
+    if (in) {
+        inner->output_fd = subst_pipe[1];
+        keep = subst_pipe[0];
+    } else {
+        redirect = _add_redirect(inner, REDIRECT_ACTION_DUP, STDIN_FILENO);
+        redirect->source_fd = subst_pipe[0];
+        keep = subst_pipe[1];
     }
-    
-    if (fstflag) {
-        if (!current_command->command_flag) {
-            strncat(current_command->cmd, current->token->element, ELEMENT_MAX);
-            if (current_command->argc < ARG_MAX)
-                current_command->argv[current_command->argc++] = current->token->element;
-            else
-                print_error("psh: too many arguments.", root);
-            current_command->command_flag = true;
-        } else {
-            if (current_command->argc < ARG_MAX)
-                current_command->argv[current_command->argc++] = current->token->element;
-            else
-                print_error("psh: too many arguments.", root);
+    stages = _start_pipeline(tree_node(subtree, subtree->root), inner,
+                             subtree, &pids);
+    fd_close(in ? subst_pipe[1] : subst_pipe[0]);
+    _add_substs(current_command, inner->substs, inner->subst_count);
+    _add_substs(current_command, pids, stages);
+
+    redirect = _add_redirect(current_command, REDIRECT_ACTION_DATA, keep);
+    redirect->source_fd = keep;
+    snprintf(path, sizeof(path), "/dev/fd/%d", keep);
+    _append_text(current_command, path, strlen(path));
+}
+
+/*
+ * _expand_word - expand the pieces chained from `head' into one word
+ *
+ * Every piece is copied once, straight into the command's buffer.
+ * `head' is a <word> node or a redirection operator whose target word
+ * hangs from it.
+ */
+static const char *_expand_word(const node_t *head,
+                                command_t *current_command, tree_t *tree) {
+    const node_t *word, *elh;
+
+    _begin_word(current_command);
+    for (word = head; word != NULL; word = _right(tree, word)) {
+        if (word != head && !_is_word(word->spec))  break;
+        elh = _left(tree, word);
+        if (elh == NULL)  break;
+        switch (elh->spec) {
+        case ENV: case ENV_WORD:
+            _eat_env(elh, current_command, tree);
+            break;
+        case SUBST: case SUBST_WORD:
+            _eat_subst(elh, current_command, tree);
+            break;
+        case PROC_SUBST_IN: case PROC_SUBST_IN_WORD:
+        case PROC_SUBST_OUT: case PROC_SUBST_OUT_WORD:
+            _eat_proc_subst(elh, current_command, tree);
+            break;
+        case LETTER: case WORD:
+            _eat_letter(elh, current_command, tree);
+            break;
+        case ALPHANUM:
+            _eat_alphanum(elh, current_command, tree);
+            break;
+        case NUM:
+            _eat_num(elh, current_command, tree);
+            break;
+        case HOME: case HOME_WORD:
+            _eat_home(elh, current_command, tree);
+            break;
+        default:
+            break;
         }
     }
+
+    return _end_word(current_command);
+}
+
+/**
+ * add_argument - append `arg' to argv; the first one names the command
+ * @current_command: command being built
+ * @arg: argument, which must live as long as the line
+ */
+void add_argument(command_t *current_command, const char *arg)
+{
+    char **argv;
+
+    if (current_command->argc + 1 == current_command->argv_capacity) {
+        argv = (char **) arena_alloc(current_command->arena, sizeof(char *)
+                                     * current_command->argv_capacity * 2);
+        memcpy(argv, current_command->argv,
+               sizeof(char *) * current_command->argc);
+        current_command->argv = argv;
+        current_command->argv_capacity *= 2;
+    }
+    if (!current_command->command_flag) {
+        current_command->cmd = arg;
+        current_command->command_flag = true;
+    }
+    current_command->argv[current_command->argc++] = (char *) arg;
+    current_command->argv[current_command->argc] = NULL;
+    current_command->arg_bytes += strlen(arg) + 1 + sizeof(char *);
+}
+
+/**
+ * arg_max_bytes - get the kernel's limit on argv and envp of a new process
+ */
+size_t arg_max_bytes(void)
+{
+    static size_t arg_max = 0;
+    long limit;
+
+    if (arg_max == 0) {
+        limit = sysconf(_SC_ARG_MAX);
+        arg_max = (limit > 0) ? (size_t) limit : 4096 * 32;
+    }
+    return arg_max;
+}
+
+/*
+ * _fits_arg_max - check whether the command and environment can be passed
+ * to a new process image
+ */
+static bool _fits_arg_max(const command_t *current_command)
+{
+    if (current_command->arg_bytes + current_command->envp_bytes
+        <= arg_max_bytes())
+        return true;
+    fprintf(stderr, "psh: %s: argument list too long\n", current_command->cmd);
+
+    return false;
+}
+
+/*
+ * _eat_word - eat <word>
+ */
+static void _eat_word(const node_t *current, command_t *current_command,
+                      tree_t *tree) {
+    const char *word;
+
+    if (current->left == NO_NODE)  return;
+    word = _expand_word(current, current_command, tree);
+    // With no quoting, an empty word can only come from expansions which
+    // gave nothing, and such a word goes away.
+    if (word[0] != '\0')
+        add_argument(current_command, word);
 }
 
 /*
  * _eat_env_assignment - eat <env_assignment>
  */
 static void _eat_env_assignment(const node_t *current,
-                                command_t *current_command, node_t *root) {
-    const node_t *env_assignment = current;
-    
-    char *assign = env_assignment->token->element;
-    if (!putenv(assign))
-        print_error("psh: can't assgin environment variable.\n", root);
+                                command_t *current_command, tree_t *tree) {
+    const node_t *env_assignment = _left(tree, current);
+    const char *assign = _node_text(env_assignment);
+    assignment_t *assignment;
+
+    // After the command name NAME=value is just another argument.
+    if (current_command->command_flag) {
+        add_argument(current_command, assign);
+        return;
+    }
+    // Whether it sets a variable or goes to the command is known only
+    // once the whole command has been read.
+    assignment = (assignment_t *) arena_alloc(current_command->arena,
+                                              sizeof(assignment_t));
+    assignment->next = NULL;
+    assignment->pair = assign;
+    assignment->name_length = strchr(assign, '=') - assign;
+    if (current_command->last_assignment == NULL)
+        current_command->assignments = assignment;
+    else
+        current_command->last_assignment->next = assignment;
+    current_command->last_assignment = assignment;
+}
+
+/*
+ * _add_redirect - append a redirection action to `current_command'
+ */
+static redirect_t *_add_redirect(command_t *current_command,
+                                 const redirect_kind_t kind, const int fd)
+{
+    redirect_t *redirect =
+        (redirect_t *) arena_alloc(current_command->arena, sizeof(redirect_t));
+
+    redirect->next = NULL;
+    redirect->kind = kind;
+    redirect->fd = fd;
+    redirect->source_fd = -1;
+    redirect->flags = 0;
+    redirect->path = NULL;
+    if (current_command->last_redirect == NULL)
+        current_command->redirects = redirect;
+    else
+        current_command->last_redirect->next = redirect;
+    current_command->last_redirect = redirect;
+
+    return redirect;
+}
+
+/*
+ * _detach_stdin - read a background job's input from /dev/null
+ *
+ * The action goes first, so a '<' written on the command still wins.
+ */
+static void _detach_stdin(command_t *current_command)
+{
+    redirect_t *redirect =
+        (redirect_t *) arena_alloc(current_command->arena, sizeof(redirect_t));
+
+    redirect->kind = REDIRECT_ACTION_OPEN;
+    redirect->fd = STDIN_FILENO;
+    redirect->source_fd = -1;
+    redirect->flags = O_RDONLY;
+    redirect->path = "/dev/null";
+    redirect->next = current_command->redirects;
+    if (current_command->last_redirect == NULL)
+        current_command->last_redirect = redirect;
+    current_command->redirects = redirect;
+}
+
+/*
+ * _redirected_fd - get the fd written before the operator, or `fallback'
+ */
+static inline int _redirected_fd(const node_t *redirection, const int fallback)
+{
+    return _is_abstract_node(redirection) ?
+        fallback : atoi(_node_text(redirection));
 }
 
 /*
  * _eat_redirection_out - eat <redirection_out>
  */
 static void _eat_redirection_out(node_t *current,
-                                 command_t *current_command, node_t *root) {
+                                 command_t *current_command, tree_t *tree) {
     const node_t *redirection_out = current;
-    const node_t *word = current->left;  // container_of(&(current->head->left), node_t, head);
-    const char* filename;
-    char *mode;
-    FILE *stream;
-
-    switch (redirection_out->token->spec) {
-    case REDIRECT_OUT: case REDIRECT_OUT_COMPOSITION:
-        mode = "w";
+    const node_t *word = _left(tree, current);
+    const int fd = _redirected_fd(redirection_out, STDOUT_FILENO);
+    redirect_t *redirect;
+
+    switch (redirection_out->spec) {
+    case REDIRECT_OUT_COMPOSITION:
+        if (word == NULL)
+            break;
+        if (word->spec == NUM && _right(tree, current) == NULL) {
+            redirect = _add_redirect(current_command, REDIRECT_ACTION_DUP, fd);
+            redirect->source_fd = atoi(_node_text(word));
+            break;
+        }
+        // ">& file" is "> file 2>&1".
+        redirect = _add_redirect(current_command, REDIRECT_ACTION_OPEN, fd);
+        redirect->flags = O_WRONLY | O_CREAT | O_TRUNC;
+        redirect->path = _expand_word(current, current_command, tree);
+        if (fd == STDOUT_FILENO) {
+            redirect = _add_redirect(current_command, REDIRECT_ACTION_DUP,
+                                     STDERR_FILENO);
+            redirect->source_fd = STDOUT_FILENO;
+        }
+        break;
+    case REDIRECT_OUT:
+        redirect = _add_redirect(current_command, REDIRECT_ACTION_OPEN, fd);
+        redirect->flags = O_WRONLY | O_CREAT | O_TRUNC;
+        redirect->path = _expand_word(current, current_command, tree);
         break;
     case REDIRECT_OUT_APPEND:
-        mode = "a";
+        redirect = _add_redirect(current_command, REDIRECT_ACTION_OPEN, fd);
+        redirect->flags = O_WRONLY | O_CREAT | O_APPEND;
+        redirect->path = _expand_word(current, current_command, tree);
         break;
     default:
         break;
     }
+}
 
-    if (!_is_abstract_node(redirection_out)) {
-        const char* streamname = redirection_out->token->element;
-        int streamfd = atoi(streamname);
-        stream = fdopen(streamfd, mode);
-    } else {
-        stream = stdout;
-    }
-    current->oldstreamfd = fcntl(fileno(stream), F_DUPFD, STDIN_FILENO);
-    filename = word->token->element;
+/*
+ * _eat_heredoc - eat "<<" with its body or "<<<" with its word
+ *
+ * The body is handed over through fd_data(), so the child reads it from
+ * a pipe or memfd rather than a temporary file.  A here-string gets a
+ * newline after the expanded word.
+ */
+static void _eat_heredoc(node_t *current, command_t *current_command,
+                         const int fd, tree_t *tree) {
+    const node_t *body = _left(tree, current);
+    redirect_t *redirect;
+    const char *data = "";
+    size_t length = 0;
+    char *line;
 
-    if (redirection_out->token->spec == REDIRECT_OUT_COMPOSITION) {
-        int redirectfd = atoi(filename);
-        dup2(redirectfd, fileno(stream));
-        fclose(stream);
-    } else {
-        if (!freopen(filename, mode, stream)) {
-            print_error("psh: could not redirect stdout from file.\n", root);
-        }
+    if (current->spec == HEREDOC && body != NULL && body->text != NULL) {
+        data = body->text->data;
+        length = body->text->length;
+    } else if (current->spec == HERE_STRING) {
+        data = _expand_word(current, current_command, tree);
+        length = strlen(data);
+        line = (char *) arena_alloc(current_command->arena, length + 1);
+        memcpy(line, data, length);
+        line[length++] = '\n';
+        data = line;
     }
+    redirect = _add_redirect(current_command, REDIRECT_ACTION_DATA, fd);
+    redirect->source_fd = fd_data(data, length);
+    if (redirect->source_fd == -1)
+        print_error("psh: here-document failure", tree);
 }
 
 /*
  * _eat_redirection_in - eat <redirection_in>
  */
 static void _eat_redirection_in(node_t *current,
-                                command_t *current_command, node_t *root) {
+                                command_t *current_command, tree_t *tree) {
     const node_t *redirection_in = current;
-    const node_t *word = current->left;  // container_of(&(current->head->left), node_t, head);
-    const char* filename;
-    FILE *stream;
-    char *mode;
-    
-    if (!_is_abstract_node(redirection_in)) {
-        const char* streamname = redirection_in->token->element;
-        int streamfd = atoi(streamname);
-        stream = fdopen(streamfd, "r");
-    } else {
-        stream = stdin;
-    }
-    
-    switch (redirection_in->token->spec) {
-    case REDIRECT_IN:
-        mode = "r";
-        break;
-    case REDIRECT_IN_OUT:
-        mode = "r+";
-    default:  break;
-    }
-    
-    current->oldstreamfd = fcntl(fileno(stream), F_DUPFD, STDIN_FILENO);
-    filename = word->token->element;
+    const int fd = _redirected_fd(redirection_in, STDIN_FILENO);
+    redirect_t *redirect;
 
-    if (!freopen(filename, mode, stream)) {
-        print_error("psh: could not redirect stdin from file. \n", root);
+    if (redirection_in->spec == HEREDOC || redirection_in->spec == HERE_STRING) {
+        _eat_heredoc(current, current_command, fd, tree);
+        return;
     }
+    redirect = _add_redirect(current_command, REDIRECT_ACTION_OPEN, fd);
+    redirect->flags = (redirection_in->spec == REDIRECT_IN_OUT) ?
+        O_RDWR | O_CREAT : O_RDONLY;
+    redirect->path = _expand_word(current, current_command, tree);
 }
 
 /*
  * _eat_redirection - eat <redirection>
  */
 static void _eat_redirection(const node_t *current,
-                             command_t* current_command, node_t *root) {
-    node_t *redirect_in_out = 
-        current->left;  // container_of(&(current->head->left), node_t, head);
+                             command_t* current_command, tree_t *tree) {
+    node_t *redirect_in_out = _left(tree, current);
     
-    switch (redirect_in_out->token->spec) {
+    switch (redirect_in_out->spec) {
     case REDIRECT_IN_PATTERN:
-        _eat_redirection_in(redirect_in_out, current_command, root);
+        _eat_redirection_in(redirect_in_out, current_command, tree);
         break;
     case REDIRECT_OUT_PATTERN:
-        _eat_redirection_out(redirect_in_out, current_command, root);
+        _eat_redirection_out(redirect_in_out, current_command, tree);
         break;
     default:
         break;
@@ -433,90 +1198,142 @@ static void _eat_redirection(const node_t *current,
  * _eat_redirection_list - eat <redirect_list>
  */
 static void _eat_redirection_list(const node_t *current,
-                                  command_t *current_command, node_t *root) {
-    const node_t *redirection = current->left;  // container_of(&(current->head->left), node_t, head);
-    const node_t *redirection_list = 
-        current->right;  // container_of(&(current->head->right), node_t, head);
+                                  command_t *current_command, tree_t *tree) {
+    const node_t *redirection_list = current;
 
-    _eat_redirection(redirection, current_command, root);
-    
-    if (redirection_list != NULL && _is_redirection(redirection_list->token))
-        _eat_redirection_list(redirection_list, current_command, root);
+    do {
+        _eat_redirection(_left(tree, redirection_list), current_command, tree);
+        redirection_list = _right(tree, redirection_list);
+    } while (redirection_list != NULL &&
+             _is_redirection(redirection_list->spec));
 }
 
 /*
  * _eat_command_element - eat <command_element>
  */
 static void _eat_command_element(const node_t *current,
-                                 command_t *current_command, node_t *root) {
-    const node_t *wer = current->left;  // container_of(&(current->head->left), node_t, head);
-    const node_t *command_element =
-        current->right;  // container_of(&(current->head->right), node_t, head);
-
-    if (wer == NULL)  return;
-    switch (wer->token->spec) {
-    case WORD_PATTERN:
-        _eat_word((node_t *)wer, current_command, true, root);
-        break;
-    case ENV_ASSIGNMENT:
-        _eat_env_assignment(wer, current_command, root);
-        break;
-    case REDIRECT_PATTERN:
-        _eat_redirection_list(wer, current_command, root);
-        break;
-    default:
-        break;
-    }
+                                 command_t *current_command, tree_t *tree) {
+    const node_t *command_element = current, *wer;
 
-    if (command_element != NULL && _is_command_element(command_element->token))
-        _eat_command_element(command_element, current_command, root);
+    do {
+        wer = _left(tree, command_element);
+        if (wer == NULL)  return;
+        switch (wer->spec) {
+        case WORD_PATTERN:
+            _eat_word(wer, current_command, tree);
+            break;
+        case ENV_ASSIGNMENT:
+            _eat_env_assignment(wer, current_command, tree);
+            break;
+        case REDIRECT_PATTERN:
+            _eat_redirection_list(wer, current_command, tree);
+            break;
+        default:
+            break;
+        }
+        command_element = _right(tree, command_element);
+    } while (command_element != NULL &&
+             _is_command_element(command_element->spec));
 }
 
 /*
  * _eat_command - eat <command>
  */
 static void _eat_command(const node_t *current, command_t *current_command,
-                         node_t *root)
+                         tree_t *tree)
 {
-    const node_t *command_element, *command;
-    command_element = current->left;  // container_of(&(current->head->left), node_t, head);
-    command = current->right;  // container_of(&(current->head->right), node_t, head);
-    
-    _eat_command_element(command_element, current_command, root);
-    if (command != NULL && _is_command(command->token))
-        _eat_command(command, current_command, root);
+    const node_t *command = current;
+
+    do {
+        _eat_command_element(_left(tree, command), current_command, tree);
+        command = _right(tree, command);
+    } while (command != NULL && _is_command(command->spec));
 }
 
 /*
- * _eat_piped_command - eat <piped_command>
+ * _start_pipeline - start every stage of <piped_command> without waiting
+ *
+ * Sets `*pids' to the pid of each stage and returns their number, or -1
+ * for an empty line.
  */
-static void _eat_piped_command(const node_t *current, command_t *current_command,
-                               const bool head_flag, node_t *root)
+static int _start_pipeline(const node_t *current, command_t *current_command,
+                           tree_t *tree, pid_t **pids_ptr)
 {
     node_t *command_element, *command;
-    command_element = current->left;  // container_of(&(current->head->left), node_t, head);
-    if (_is_eof(command_element->token) || _is_eol(command_element->token))
-        return ;
-    command = current->right;  // container_of(&(current->head->right), node_t, head);
-    _eat_command_element(command_element, current_command, root);
-    if (command != NULL && _is_command(command->token)) {
-        _fork_exec(current_command, head_flag, false, root);
-        _init_redirection_stream(command_element);
+    bool head = true, tail;
+    pid_t *pids;
+    int stages = 0;
+
+    command_element = _left(tree, current);
+    if (_is_eof(command_element->spec) || _is_eol(command_element->spec))
+        return -1;
+    for (command = (node_t *)current; command != NULL;
+         command = _right(tree, command))
+        stages++;
+    pids = (pid_t *) arena_alloc(tree->arena, sizeof(pid_t) * stages);
+
+    // Start every stage before waiting for any, so that they run side by
+    // side and no stage blocks on a full pipe nobody is reading yet.
+    stages = 0;
+    for (;;) {
+        command_element = _left(tree, current);
+        command = _right(tree, current);
+        tail = (command == NULL || !_is_command(command->spec));
+        _eat_command_element(command_element, current_command, tree);
+        if (head && current_command->background)
+            _detach_stdin(current_command);
+        pids[stages++] = _fork_exec(current_command, head, tail, tree);
+        if (tail)  break;
         _init_command(current_command);
-        _eat_piped_command(command, current_command, false, root);
-    } else {
-        _fork_exec(current_command, head_flag, true, root);
-        _init_redirection_stream(command_element);
+        current = command;
+        head = false;
     }
+    *pids_ptr = pids;
+
+    return stages;
+}
+
+/*
+ * _eat_piped_command - eat <piped_command> and get its exit status
+ */
+static int _eat_piped_command(const node_t *current, command_t *current_command,
+                              tree_t *tree)
+{
+    pid_t *pids;
+    int stages = _start_pipeline(current, current_command, tree, &pids);
+
+    int status;
+
+    if (stages == -1)
+        return -1;
+    if (current_command->background) {
+        // Substituted processes go first, as the job's status is that of
+        // its last process.
+        _add_substs(current_command, pids, stages);
+        if (job_add(current_command->substs, current_command->subst_count,
+                    tree->source, tree->source_length) == 0)
+            return current_command->status;
+        return EXIT_SUCCESS;
+    }
+    status = _wait_pipeline(pids, stages, current_command->status);
+    _wait_pipeline(current_command->substs, current_command->subst_count,
+                   EXIT_SUCCESS);
+    return status;
 }
 
 /**
  * eat_root - execute commands in the given tree sequencially
- * @root: the root of syntax tree
+ * @tree: the syntax tree
+ * @last: nothing runs after this tree, so a lone external command may
+ *        replace the shell process
+ *
+ * Returns the exit status of the pipeline, or -1 for an empty line.
  */
-void eat_root(node_t *root)
+int eat_root(tree_t *tree, const bool last)
 {
-    command_t *current_command = init_command(root);
-    _eat_piped_command(root, current_command, true, root);
-    free(current_command);
+    command_t *current_command = init_command(tree);
+
+    current_command->exec_flag = last;
+    return _eat_piped_command(tree_node(tree, tree->root), current_command,
+                              tree);
 }
@@ -11,55 +11,172 @@
 #define PSH_EXECUTOR_H_
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 
 #include "tokenizer.h"
 #include "parser.h"
 #include "tree.h"
 
+/*
+ * A redirection is compiled into an action which only the child carries
+ * out: either open `path' onto `fd', or duplicate `source_fd' onto it.
+ * For a here-document or here-string `source_fd' is made by the shell to
+ * hold the body, and the shell closes it once the command has started.
+ * A process substitution hands its pipe end over the same way, with
+ * `fd' equal to `source_fd' so that /dev/fd/N names it in the child.
+ */
+typedef enum redirect_kind {
+    REDIRECT_ACTION_OPEN,
+    REDIRECT_ACTION_DUP,
+    REDIRECT_ACTION_DATA,
+} redirect_kind_t;
+
+typedef struct redirect {
+    struct redirect *next;
+    redirect_kind_t kind;
+    int fd;
+    int source_fd;
+    int flags;
+    const char *path;
+} redirect_t;
+
+/*
+ * NAME=value written before the command name; `pair' is that text.
+ */
+typedef struct assignment {
+    struct assignment *next;
+    const char *pair;
+    size_t name_length;
+} assignment_t;
+
+/*
+ * Expanded words of a command are written one after another into this
+ * buffer, which comes from the line's arena.
+ */
+typedef struct word_buffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+    size_t start;  // offset of the word being built
+} word_buffer_t;
+
 typedef struct command {
-    char cmd[ELEMENT_MAX];
-    char *argv[ARG_MAX];
+    const char *cmd;  // argv[0], or "" before the first word
+    char **argv;  // NULL terminated, grows as words are added
     int argc;
+    int argv_capacity;
+    size_t arg_bytes;  // what argv takes up in a new process image
     bool command_flag;
+    bool exec_flag;  // the final command may exec in place of the shell
+    bool background;  // the pipeline runs as a job, unwaited
     int input_fd;
-    int output_fd;
+    int output_fd;  // where the last stage writes, -1 for the shell's stdout
+    bool capture;  // the last stage writes into a pipe left in input_fd
+    int status;  // exit status of a stage which did not become a process
+    char *captured;  // what a builtin run inside the shell printed for `...`
+    size_t captured_length;
+    pid_t *substs;  // of <(...), >(...) and fan-outs, reaped with the line
+    int subst_count;
+    int subst_capacity;
+    redirect_t *redirects;  // in the order they were written
+    redirect_t *last_redirect;
+    assignment_t *assignments;  // in the order they were written
+    assignment_t *last_assignment;
+    char **envp;  // what the command is started with
+    size_t envp_bytes;  // what envp takes up in a new process image
+    word_buffer_t words;
+    arena_t *arena;
 } command_t;
 
 /**
  * print_error - print error message and finalize program
  */
-void print_error(const char *error_message, node_t *root);
+void print_error(const char *error_message, tree_t *tree);
 
 /*
  * _init_command - initialize command except for I/O fd
  */
 static inline void *_init_command(command_t *command)
 {
-    memset(command->cmd, '\0', ELEMENT_MAX);
-    memset(command->argv, '\0', ARG_MAX);
+    command->cmd = "";
+    command->argv[0] = NULL;
     command->argc = 0;
+    command->arg_bytes = 0;
     command->command_flag = false;
+    command->redirects = NULL;
+    command->last_redirect = NULL;
+    command->assignments = NULL;
+    command->last_assignment = NULL;
+    command->envp = NULL;
+    command->envp_bytes = 0;
+    command->words.length = command->words.start = 0;
     return command;
 }
 
 /**
  * init_command - return initialized command
+ * @tree: the syntax tree whose arena holds the command and expanded words
  */
-static inline command_t *init_command(node_t *root)
+static inline command_t *init_command(tree_t *tree)
 {
-    command_t *command = (command_t *) malloc(sizeof(command_t));
-    if (command == NULL) {
-        print_error("Bad allocation (command).\n", root);
-    }
+    command_t *command =
+        (command_t *) arena_alloc(tree->arena, sizeof(command_t));
+    command->argv = (char **) arena_alloc(tree->arena,
+                                          sizeof(char *) * ARGV_INITIAL_SIZE);
+    command->argv_capacity = ARGV_INITIAL_SIZE;
     _init_command(command);
+    command->status = EXIT_SUCCESS;
+    command->exec_flag = false;
+    command->background = tree->background;
+    command->output_fd = -1;
+    command->capture = false;
+    command->captured = NULL;
+    command->captured_length = 0;
+    command->substs = NULL;
+    command->subst_count = command->subst_capacity = 0;
+    command->words.data = NULL;
+    command->words.capacity = 0;
+    command->arena = tree->arena;
     return command;
 }
 
+/**
+ * add_argument - append `arg' to argv; the first one names the command
+ * @current_command: command being built
+ * @arg: argument, which must live as long as the line
+ */
+void add_argument(command_t *current_command, const char *arg);
+
+/**
+ * start_command - start `command' in a child of its own without waiting
+ * @current_command: command whose argv has been filled in
+ * @capture: send its stdout into a new pipe rather than the shell's
+ * @tree: tree whose arena holds the command
+ *
+ * Returns the pid, or -1 with the status set; a captured stdout is read
+ * from input_fd.
+ */
+pid_t start_command(command_t *current_command, const bool capture,
+                    tree_t *tree);
+
+/**
+ * arg_max_bytes - get the kernel's limit on argv and envp of a new process
+ *
+ * This is sysconf(_SC_ARG_MAX); strings count with their NULs and
+ * pointers.
+ */
+size_t arg_max_bytes(void);
+
 /**
  * eat_root - execute commands in the given tree sequencially
- * @root: the root of syntax tree
+ * @tree: the syntax tree
+ * @last: nothing runs after this tree, so a lone external command may
+ *        replace the shell process
+ *
+ * Returns the exit status of the pipeline, or -1 for an empty line.  A
+ * pipeline ending with '&' becomes a job and counts as a success.
  */
-void eat_root(node_t *root);
+int eat_root(tree_t *tree, const bool last);
 
 #endif  // PSH_EXECUTOR_H_
@@ -0,0 +1,303 @@
+/*
+ * fd.c - keep track of the descriptors the shell opens for pipelines
+ *
+ * This source code is licensed under the MIT License.
+ * See the file COPYING for more details.
+ *
+ * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "fd.h"
+
+static uint64_t tracked[FD_TRACK_MAX / 64];  // pipeline ends
+static uint64_t held[FD_TRACK_MAX / 64];  // meant to outlive a line
+
+/*
+ * _mark - set or clear the bit of `fd' in `set'
+ */
+static inline void _mark(uint64_t *set, const int fd, const bool on)
+{
+    if (fd < 0 || fd >= FD_TRACK_MAX)  return;
+    if (on)
+        set[fd / 64] |= (uint64_t) 1 << (fd % 64);
+    else
+        set[fd / 64] &= ~((uint64_t) 1 << (fd % 64));
+}
+
+/*
+ * _is_marked - check whether the bit of `fd' is set in `set'
+ */
+static inline bool _is_marked(const uint64_t *set, const int fd)
+{
+    return fd >= 0 && fd < FD_TRACK_MAX
+        && (set[fd / 64] & ((uint64_t) 1 << (fd % 64))) != 0;
+}
+
+/**
+ * fd_pipe - create a close-on-exec pipe and track both of its ends
+ * @fds: where the read and write ends are stored
+ */
+int fd_pipe(int fds[2])
+{
+    if (pipe2(fds, O_CLOEXEC) != 0)
+        return -1;
+    _mark(tracked, fds[0], true);
+    _mark(tracked, fds[1], true);
+
+    return 0;
+}
+
+/*
+ * _write_all - write `length' bytes of `data' to `fd'
+ */
+static int _write_all(const int fd, const char *data, size_t length)
+{
+    ssize_t n;
+
+    while (length > 0) {
+        n = write(fd, data, length);
+        if (n == -1 && errno == EINTR)  continue;
+        if (n == -1)  return -1;
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/**
+ * fd_data - get a tracked descriptor from which `data' can be read
+ * @data: bytes to be read, such as a here-document body
+ * @length: length of `data'
+ *
+ * A body which fits in a pipe's buffer is written into a pipe whose
+ * write end is closed at once; anything larger goes into a memfd, so it
+ * never touches the filesystem.  Returns -1 on failure.
+ */
+int fd_data(const char *data, const size_t length)
+{
+    int fds[2], fd;
+
+    if (fd_pipe(fds) != 0)
+        return -1;
+    if (length <= (size_t) fcntl(fds[1], F_GETPIPE_SZ)) {
+        fd = (_write_all(fds[1], data, length) == 0) ? fds[0] : -1;
+        fd_close(fds[1]);
+        if (fd == -1)  fd_close(fds[0]);
+        return fd;
+    }
+    fd_close(fds[0]);
+    fd_close(fds[1]);
+
+    fd = memfd_create("psh-heredoc", MFD_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    if (_write_all(fd, data, length) != 0 || lseek(fd, 0, SEEK_SET) != 0) {
+        close(fd);
+        return -1;
+    }
+    _mark(tracked, fd, true);
+
+    return fd;
+}
+
+/*
+ * _move - move `length' bytes from the pipe `from' to `to'
+ *
+ * Returns -1 when `to' stopped taking data.
+ */
+static int _move(const int from, const int to, size_t length)
+{
+    char buffer[FD_COPY_SIZE];
+    ssize_t n;
+
+    while (length > 0) {
+        n = splice(from, NULL, to, NULL, length, SPLICE_F_MOVE);
+        if (n == -1 && errno == EINTR)  continue;
+        if (n == -1 && errno == EINVAL) {
+            // Such as a terminal, which has no splice_write.
+            n = read(from, buffer,
+                     (length < sizeof(buffer)) ? length : sizeof(buffer));
+            if (n <= 0 || _write_all(to, buffer, n) != 0)
+                return -1;
+        } else if (n <= 0) {
+            return -1;
+        }
+        length -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * _drop - close the pipe of a sink which has been given up
+ */
+static void _drop(int own[2], int *live)
+{
+    close(own[0]);
+    close(own[1]);
+    own[0] = own[1] = -1;
+    (*live)--;
+}
+
+/**
+ * fd_fanout - copy everything read from the pipe `in' to each of `sinks'
+ * @in: read end of a pipe
+ * @sinks: descriptors to write to, such as files or pipes
+ * @count: number of `sinks'
+ *
+ * Every sink has a pipe of its own into which each chunk of `in' is
+ * tee(2)'d and from which it is spliced out; the chunk is then dropped
+ * from `in' by splicing it into /dev/null.  The pipes of the sinks are
+ * as large as `in' and empty before each chunk, so each of them takes
+ * the whole chunk.
+ */
+int fd_fanout(const int in, const int *sinks, const int count)
+{
+    int (*own)[2] = malloc(sizeof(int[2]) * (count > 0 ? count : 1));
+    const int size = fcntl(in, F_GETPIPE_SZ);
+    int discard = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    int i, live = 0, result = -1;
+    ssize_t n = 0, chunk;
+
+    if (own == NULL) {
+        fprintf(stderr, "Bad allocation (fd) \n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < count; i++) {
+        if (pipe2(own[i], O_CLOEXEC) != 0) {
+            own[i][0] = own[i][1] = -1;
+            continue;
+        }
+        if (size > 0)  fcntl(own[i][1], F_SETPIPE_SZ, size);
+        live++;
+    }
+
+    while (live > 0 && discard != -1) {
+        chunk = 0;
+        for (i = 0; i < count; i++) {
+            if (own[i][1] == -1)  continue;
+            // The first tee waits for data and sets the size of the chunk.
+            do
+                n = tee(in, own[i][1], (chunk == 0) ? INT_MAX : chunk, 0);
+            while (n == -1 && errno == EINTR);
+            if (chunk == 0 && n <= 0)
+                break;
+            if (chunk == 0)
+                chunk = n;
+            else if (n != chunk)
+                _drop(own[i], &live);
+        }
+        if (chunk == 0) {
+            result = (n == 0) ? 0 : -1;
+            break;
+        }
+        for (i = 0; i < count; i++)
+            if (own[i][0] != -1 && _move(own[i][0], sinks[i], chunk) != 0)
+                _drop(own[i], &live);
+        if (_move(in, discard, chunk) != 0)
+            break;
+    }
+
+    for (i = 0; i < count; i++)
+        if (own[i][0] != -1)  _drop(own[i], &live);
+    if (discard != -1)  close(discard);
+    free(own);
+
+    return result;
+}
+
+/**
+ * fd_pidfd_open - get a descriptor which turns readable once `pid' exits
+ * @pid: child process, ignored when -1
+ *
+ * The descriptor is close-on-exec.  Returns -1 when `pid' is -1 or the
+ * kernel has no pidfds.
+ */
+int fd_pidfd_open(const pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    if (pid != -1)
+        return syscall(SYS_pidfd_open, pid, 0);
+#endif
+    return -1;
+}
+
+/**
+ * fd_hold - note that `fd' is meant to stay open across lines
+ * @fd: descriptor such as a running job's pidfd or the script file
+ */
+void fd_hold(int fd)
+{
+    _mark(held, fd, true);
+}
+
+/**
+ * fd_close - close a descriptor and stop tracking it
+ * @fd: descriptor, ignored when negative
+ */
+void fd_close(int fd)
+{
+    if (fd < 0)  return;
+    close(fd);
+    _mark(tracked, fd, false);
+    _mark(held, fd, false);
+}
+
+/**
+ * fd_close_private - close every shell-private descriptor in a child
+ * @first: lowest descriptor to close, at least FD_FIRST_PRIVATE
+ */
+void fd_close_private(const int first)
+{
+    if (close_range(first, ~0U, 0) != 0) {
+        // Kernels before 5.9 have no close_range.
+        long fd, max = sysconf(_SC_OPEN_MAX);
+        for (fd = first; fd < max; fd++)
+            close(fd);
+    }
+}
+
+/**
+ * fd_report - print the shell-private descriptors which are still open
+ * @stream: stream to print to
+ */
+bool fd_report(FILE *stream)
+{
+    DIR *dir = opendir("/proc/self/fd");
+    struct dirent *entry;
+    char target[PATH_MAX], path[64];
+    ssize_t length;
+    bool clean = true;
+    int fd;
+
+    if (dir == NULL)  return true;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')  continue;
+        fd = atoi(entry->d_name);
+        if (fd < FD_FIRST_PRIVATE || fd == dirfd(dir) || _is_marked(held, fd))
+            continue;
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+        length = readlink(path, target, sizeof(target) - 1);
+        target[length < 0 ? 0 : length] = '\0';
+        fprintf(stream, "psh: fd: %d still open -> %s%s\n", fd, target,
+                _is_marked(tracked, fd) ? " (pipeline)" : "");
+        clean = false;
+    }
+    closedir(dir);
+
+    return clean;
+}
@@ -0,0 +1,93 @@
+/*
+ * fd.h - keep track of the descriptors the shell opens for pipelines
+ *
+ * This source code is licensed under the MIT License.
+ * See the file COPYING for more details.
+ *
+ * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
+ */
+
+#ifndef PSH_FD_H_
+#define PSH_FD_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define FD_TRACK_MAX  1024
+#define FD_COPY_SIZE  4096  // for sinks which splice(2) cannot write to
+
+/*
+ * Descriptors from 0 up to FD_FIRST_PRIVATE - 1 belong to the command
+ * being run; everything above is the shell's own and is closed in
+ * children before they run anything.
+ */
+#define FD_FIRST_PRIVATE  3
+
+/**
+ * fd_pipe - create a close-on-exec pipe and track both of its ends
+ * @fds: where the read and write ends are stored
+ */
+int fd_pipe(int fds[2]);
+
+/**
+ * fd_data - get a tracked descriptor from which `data' can be read
+ * @data: bytes to be read, such as a here-document body
+ * @length: length of `data'
+ *
+ * Small data goes through a pipe and larger data through a memfd.
+ * Returns -1 on failure.
+ */
+int fd_data(const char *data, const size_t length);
+
+/**
+ * fd_fanout - copy everything read from the pipe `in' to each of `sinks'
+ * @in: read end of a pipe
+ * @sinks: descriptors to write to, such as files or pipes
+ * @count: number of `sinks'
+ *
+ * Data is duplicated with tee(2) and moved with splice(2), so it never
+ * passes through userspace unless a sink cannot take spliced data.  A
+ * sink which fails is dropped.  Returns 0 at the end of `in', or -1 once
+ * no sink is left.
+ */
+int fd_fanout(const int in, const int *sinks, const int count);
+
+/**
+ * fd_pidfd_open - get a descriptor which turns readable once `pid' exits
+ * @pid: child process, ignored when -1
+ *
+ * The descriptor is close-on-exec.  Returns -1 when `pid' is -1 or the
+ * kernel has no pidfds.
+ */
+int fd_pidfd_open(const pid_t pid);
+
+/**
+ * fd_hold - note that `fd' is meant to stay open across lines
+ * @fd: descriptor such as a running job's pidfd or the script file
+ *
+ * Held descriptors are left out of fd_report().
+ */
+void fd_hold(int fd);
+
+/**
+ * fd_close - close a descriptor and stop tracking it
+ * @fd: descriptor, ignored when negative
+ */
+void fd_close(int fd);
+
+/**
+ * fd_close_private - close every shell-private descriptor in a child
+ * @first: lowest descriptor to close, at least FD_FIRST_PRIVATE
+ */
+void fd_close_private(const int first);
+
+/**
+ * fd_report - print the shell-private descriptors which are still open
+ * @stream: stream to print to
+ *
+ * Returns true when nothing leaked.
+ */
+bool fd_report(FILE *stream);
+
+#endif  // PSH_FD_H_
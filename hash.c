@@ -0,0 +1,223 @@
+/*
+ * hash.c - remembered locations of commands
+ *
+ * This source code is licensed under the MIT License.
+ * See the file COPYING for more details.
+ *
+ * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "hash.h"
+#include "vars.h"
+
+#define DEFAULT_PATH  "/usr/local/bin:/usr/bin:/bin"
+
+typedef struct hash_entry {
+    char *name;  // NULL for an empty slot
+    char *path;  // NULL when `name' is not in $PATH
+    uint32_t hash;
+    unsigned int hits;
+} hash_entry_t;
+
+typedef struct hash_table {
+    hash_entry_t *entries;
+    size_t size;   // always a power of two
+    size_t count;
+} hash_table_t;
+
+static hash_table_t table = { NULL, 0, 0 };
+
+/*
+ * _xstrdup - strdup which never returns NULL
+ */
+static char *_xstrdup(const char *s, size_t length)
+{
+    char *copy = (char *) malloc(length + 1);
+    if (copy == NULL) {
+        fprintf(stderr, "Bad allocation (hash) \n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, s, length);
+    copy[length] = '\0';
+
+    return copy;
+}
+
+/*
+ * _find_slot - get the slot which holds `name' or where it would go
+ */
+static hash_entry_t *_find_slot(hash_entry_t *entries, size_t size,
+                                const char *name, uint32_t hash)
+{
+    size_t i = hash & (size - 1);
+
+    while (entries[i].name != NULL) {
+        if (entries[i].hash == hash && strcmp(entries[i].name, name) == 0)
+            break;
+        i = (i + 1) & (size - 1);
+    }
+    return &(entries[i]);
+}
+
+/*
+ * _grow_table - double the table once it is 70% full
+ */
+static void _grow_table(void)
+{
+    const size_t size = (table.size == 0) ? HASH_INITIAL_SIZE : table.size * 2;
+    hash_entry_t *entries = (hash_entry_t *) calloc(size, sizeof(hash_entry_t));
+    size_t i;
+
+    if (entries == NULL) {
+        fprintf(stderr, "Bad allocation (hash) \n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < table.size; i++) {
+        if (table.entries[i].name != NULL)
+            *_find_slot(entries, size, table.entries[i].name,
+                        table.entries[i].hash) = table.entries[i];
+    }
+    free(table.entries);
+    table.entries = entries;
+    table.size = size;
+}
+
+/*
+ * _search_path - look `name' up in $PATH, return a malloc'ed path or NULL
+ */
+static char *_search_path(const char *name)
+{
+    const char *path = var_get("PATH");
+    const char *dir, *end;
+    const size_t name_length = strlen(name);
+    char *candidate = NULL;
+    size_t dir_length;
+    struct stat st;
+
+    if (path == NULL)  path = DEFAULT_PATH;
+    for (dir = path; ; dir = end + 1) {
+        end = strchr(dir, ':');
+        if (end == NULL)  end = dir + strlen(dir);
+        dir_length = end - dir;
+        free(candidate);
+        candidate = (char *) malloc(dir_length + name_length + 3);
+        if (candidate == NULL) {
+            fprintf(stderr, "Bad allocation (hash) \n");
+            exit(EXIT_FAILURE);
+        }
+        // An empty $PATH element stands for the current directory.
+        if (dir_length == 0)
+            sprintf(candidate, "./%s", name);
+        else
+            sprintf(candidate, "%.*s/%s", (int) dir_length, dir, name);
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode)
+            && access(candidate, X_OK) == 0)
+            return candidate;
+        if (*end == '\0')  break;
+    }
+    free(candidate);
+
+    return NULL;
+}
+
+/**
+ * hash_lookup - get the full path of command `name'
+ * @name: command name without any '/'
+ */
+const char *hash_lookup(const char *name)
+{
+    const uint32_t hash = hash_string(name, strlen(name));
+    hash_entry_t *entry;
+
+    if (table.size != 0) {
+        entry = _find_slot(table.entries, table.size, name, hash);
+        if (entry->name != NULL) {
+            entry->hits++;
+            return entry->path;
+        }
+    }
+    if ((table.count + 1) * 10 > table.size * 7)  _grow_table();
+    entry = _find_slot(table.entries, table.size, name, hash);
+    entry->name = _xstrdup(name, strlen(name));
+    entry->path = _search_path(name);
+    entry->hash = hash;
+    entry->hits = 1;
+    table.count++;
+
+    return entry->path;
+}
+
+/**
+ * hash_forget - drop the remembered location of `name'
+ * @name: command name
+ */
+void hash_forget(const char *name)
+{
+    hash_entry_t *entry, *next;
+    size_t i, j;
+
+    if (table.size == 0)  return;
+    entry = _find_slot(table.entries, table.size, name,
+                       hash_string(name, strlen(name)));
+    if (entry->name == NULL)  return;
+    free(entry->name);
+    free(entry->path);
+    entry->name = NULL;
+    table.count--;
+
+    // Re-insert the rest of the cluster so that probing still finds it.
+    i = entry - table.entries;
+    for (j = (i + 1) & (table.size - 1); table.entries[j].name != NULL;
+         j = (j + 1) & (table.size - 1)) {
+        hash_entry_t moved = table.entries[j];
+        table.entries[j].name = NULL;
+        next = _find_slot(table.entries, table.size, moved.name, moved.hash);
+        *next = moved;
+    }
+}
+
+/**
+ * hash_clear - forget every remembered location
+ */
+void hash_clear(void)
+{
+    size_t i;
+
+    for (i = 0; i < table.size; i++) {
+        free(table.entries[i].name);
+        free(table.entries[i].path);
+        table.entries[i].name = NULL;
+        table.entries[i].path = NULL;
+    }
+    table.count = 0;
+}
+
+/**
+ * hash_print - list remembered locations
+ * @stream: stream to print to
+ */
+void hash_print(FILE *stream)
+{
+    size_t i;
+
+    if (table.count == 0) {
+        fprintf(stream, "hash: hash table empty\n");
+        return;
+    }
+    fprintf(stream, "hits\tcommand\n");
+    for (i = 0; i < table.size; i++) {
+        const hash_entry_t *entry = &(table.entries[i]);
+        if (entry->name == NULL)  continue;
+        if (entry->path != NULL)
+            fprintf(stream, "%4u\t%s\n", entry->hits, entry->path);
+        else
+            fprintf(stream, "%4u\t%s (not found)\n", entry->hits, entry->name);
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ * hash.h - remembered locations of commands
+ *
+ * This source code is licensed under the MIT License.
+ * See the file COPYING for more details.
+ *
+ * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
+ */
+
+#ifndef PSH_HASH_H_
+#define PSH_HASH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define HASH_INITIAL_SIZE  64
+
+/*
+ * hash_string - FNV-1a hash of the first `length' characters of `s'
+ */
+static inline uint32_t hash_string(const char *s, size_t length)
+{
+    uint32_t h = 2166136261u;
+
+    while (length-- > 0) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * hash_lookup - get the full path of command `name'
+ * @name: command name without any '/'
+ *
+ * The $PATH search runs only the first time `name' is seen; both hits and
+ * misses are remembered until hash_clear().  Returns NULL when `name' is
+ * not found in $PATH.
+ */
+const char *hash_lookup(const char *name);
+
+/**
+ * hash_forget - drop the remembered location of `name'
+ * @name: command name
+ */
+void hash_forget(const char *name);
+
+/**
+ * hash_clear - forget every remembered location
+ */
+void hash_clear(void);
+
+/**
+ * hash_print - list remembered locations
+ * @stream: stream to print to
+ */
+void hash_print(FILE *stream);
+
+#endif  // PSH_HASH_H_
@@ -0,0 +1,353 @@
+/*
+ * jobs.c - background jobs
+ *
+ * This source code is licensed under the MIT License.
+ * See the file COPYING for more details.
+ *
+ * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "fd.h"
+#include "jobs.h"
+
+typedef struct process {
+    pid_t pid;
+    int pidfd;  // -1 when not watched
+    bool running;
+} process_t;
+
+typedef struct job {
+    int id;
+    int count;
+    int remaining;  // processes not reaped yet
+    int status;  // exit status of the last stage
+    bool announced;  // jobs_reap has counted it as finished
+    process_t *procs;
+    char *text;
+} job_t;
+
+typedef struct job_table {
+    job_t **jobs;  // in the order they were started
+    size_t size;
+    size_t count;
+    bool interactive;
+} job_table_t;
+
+static job_table_t table = { NULL, 0, 0, false };
+
+/*
+ * _xmalloc - malloc which never returns NULL
+ */
+static void *_xmalloc(const size_t size)
+{
+    void *p = malloc(size);
+
+    if (p == NULL) {
+        fprintf(stderr, "Bad allocation (jobs) \n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/*
+ * _exit_status - turn a wait status into a shell exit status
+ */
+static inline int _exit_status(const int wstatus)
+{
+    if (WIFSIGNALED(wstatus))
+        return 128 + WTERMSIG(wstatus);
+    return WEXITSTATUS(wstatus);
+}
+
+/*
+ * _reap - collect process `i' of `job' if it has exited
+ *
+ * Returns true when the process is gone.
+ */
+static bool _reap(job_t *job, const int i, const int options)
+{
+    process_t *proc = &(job->procs[i]);
+    pid_t result;
+    int wstatus;
+
+    while ((result = waitpid(proc->pid, &wstatus, options)) == -1
+           && errno == EINTR)
+        ;
+    if (result == 0)  return false;
+    if (result == proc->pid && i == job->count - 1)
+        job->status = _exit_status(wstatus);
+    proc->running = false;
+    fd_close(proc->pidfd);
+    proc->pidfd = -1;
+    job->remaining--;
+
+    return true;
+}
+
+/*
+ * _wait_job - block until every process of `job' has exited
+ */
+static void _wait_job(job_t *job)
+{
+    int i;
+
+    for (i = 0; i < job->count; i++)
+        if (job->procs[i].running)  _reap(job, i, 0);
+}
+
+/*
+ * _remove_job - forget the job at `index' of the table
+ */
+static void _remove_job(const size_t index)
+{
+    job_t *job = table.jobs[index];
+    int i;
+
+    for (i = 0; i < job->count; i++)
+        fd_close(job->procs[i].pidfd);
+    free(job->procs);
+    free(job->text);
+    free(job);
+    table.count--;
+    memmove(&(table.jobs[index]), &(table.jobs[index + 1]),
+            sizeof(job_t *) * (table.count - index));
+}
+
+/*
+ * _find_job - get the table index of job `id', or -1
+ */
+static int _find_job(const int id)
+{
+    size_t i;
+
+    for (i = 0; i < table.count; i++)
+        if (table.jobs[i]->id == id)  return i;
+    return -1;
+}
+
+/*
+ * _print_job - print one line of `jobs' output
+ */
+static void _print_job(FILE *stream, const job_t *job)
+{
+    if (job->remaining > 0)
+        fprintf(stream, "[%d]  Running    %s\n", job->id, job->text);
+    else if (job->status == EXIT_SUCCESS)
+        fprintf(stream, "[%d]  Done       %s\n", job->id, job->text);
+    else
+        fprintf(stream, "[%d]  Exit %-5d %s\n", job->id, job->status,
+                job->text);
+}
+
+/**
+ * init_jobs - set up the job table
+ * @interactive: announce new jobs and open a pidfd for every process so
+ *               that the input loop can wake up when one exits
+ */
+void init_jobs(const bool interactive)
+{
+    table.size = JOB_INITIAL_SIZE;
+    table.jobs = (job_t **) _xmalloc(sizeof(job_t *) * table.size);
+    table.count = 0;
+    table.interactive = interactive;
+}
+
+/**
+ * job_add - remember a pipeline started with '&'
+ * @pids: pid of every stage, -1 for stages which never became a process
+ * @count: number of stages
+ * @text: the command line as typed; a trailing '&' and blanks are dropped
+ * @length: length of `text'
+ *
+ * Returns the new job id, or 0 when no stage is running.
+ */
+int job_add(const pid_t *pids, const int count, const char *text,
+            size_t length)
+{
+    job_t *job;
+    pid_t last = -1;
+    int i;
+
+    for (i = 0; i < count; i++)
+        if (pids[i] != -1)  last = pids[i];
+    if (last == -1)  return 0;
+
+    if (table.count == table.size) {
+        table.size *= 2;
+        table.jobs = (job_t **) realloc(table.jobs,
+                                        sizeof(job_t *) * table.size);
+        if (table.jobs == NULL) {
+            fprintf(stderr, "Bad allocation (jobs) \n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    while (length > 0 && isspace((unsigned char) *text)) {
+        text++;
+        length--;
+    }
+    while (length > 0 && (isspace((unsigned char) text[length - 1])
+                          || text[length - 1] == '&'))
+        length--;
+
+    job = (job_t *) _xmalloc(sizeof(job_t));
+    job->id = (table.count == 0) ? 1 : table.jobs[table.count - 1]->id + 1;
+    job->count = count;
+    job->remaining = 0;
+    job->status = EXIT_SUCCESS;
+    job->announced = false;
+    job->procs = (process_t *) _xmalloc(sizeof(process_t) * count);
+    job->text = (char *) _xmalloc(length + 1);
+    memcpy(job->text, text, length);
+    job->text[length] = '\0';
+    for (i = 0; i < count; i++) {
+        job->procs[i].pid = pids[i];
+        job->procs[i].running = (pids[i] != -1);
+        job->procs[i].pidfd = (job->procs[i].running && table.interactive) ?
+            fd_pidfd_open(pids[i]) : -1;
+        // Without pidfds the job is still reaped before every prompt,
+        // only not the moment it finishes.
+        fd_hold(job->procs[i].pidfd);
+        if (job->procs[i].running)  job->remaining++;
+    }
+    table.jobs[table.count++] = job;
+
+    if (table.interactive)
+        fprintf(stderr, "[%d] %d\n", job->id, (int) last);
+    return job->id;
+}
+
+/**
+ * jobs_reap - collect exited processes of every job without blocking
+ *
+ * Returns how many jobs have finished during this call.
+ */
+int jobs_reap(void)
+{
+    size_t i;
+    int j, finished = 0;
+    job_t *job;
+
+    for (i = 0; i < table.count; i++) {
+        job = table.jobs[i];
+        for (j = 0; j < job->count; j++)
+            if (job->procs[j].running)  _reap(job, j, WNOHANG);
+        if (job->remaining == 0 && !job->announced) {
+            job->announced = true;
+            finished++;
+        }
+    }
+
+    return finished;
+}
+
+/**
+ * jobs_pollfds - fill `fds' with the pidfds of running processes
+ * @fds: array of at least `max' entries
+ * @max: size of `fds'
+ *
+ * Returns the number of entries filled.
+ */
+int jobs_pollfds(struct pollfd *fds, const int max)
+{
+    size_t i;
+    int j, n = 0;
+
+    for (i = 0; i < table.count; i++)
+        for (j = 0; j < table.jobs[i]->count && n < max; j++) {
+            if (table.jobs[i]->procs[j].pidfd == -1)  continue;
+            fds[n].fd = table.jobs[i]->procs[j].pidfd;
+            fds[n].events = POLLIN;
+            fds[n].revents = 0;
+            n++;
+        }
+
+    return n;
+}
+
+/**
+ * jobs_notify - report and forget finished jobs
+ * @stream: stream to print to
+ */
+void jobs_notify(FILE *stream)
+{
+    size_t i = 0;
+
+    while (i < table.count) {
+        if (table.jobs[i]->remaining > 0) {
+            i++;
+            continue;
+        }
+        _print_job(stream, table.jobs[i]);
+        _remove_job(i);
+    }
+}
+
+/**
+ * jobs_print - list every job, then forget the finished ones
+ * @stream: stream to print to
+ */
+void jobs_print(FILE *stream)
+{
+    size_t i;
+
+    jobs_reap();
+    for (i = 0; i < table.count; i++)
+        _print_job(stream, table.jobs[i]);
+    i = 0;
+    while (i < table.count) {
+        if (table.jobs[i]->remaining == 0)
+            _remove_job(i);
+        else
+            i++;
+    }
+}
+
+/**
+ * job_wait - wait for a job and forget it
+ * @id: job id, or 0 for every job
+ *
+ * Returns the exit status of the job's last stage, EXIT_SUCCESS when
+ * `id' is 0, or -1 when there is no such job.
+ */
+int job_wait(const int id)
+{
+    int index, status;
+
+    if (id == 0) {
+        while (table.count > 0) {
+            _wait_job(table.jobs[0]);
+            _remove_job(0);
+        }
+        return EXIT_SUCCESS;
+    }
+    if ((index = _find_job(id)) == -1)
+        return -1;
+    _wait_job(table.jobs[index]);
+    status = table.jobs[index]->status;
+    _remove_job(index);
+
+    return status;
+}
+
+/**
+ * job_of_pid - get the id of the job which `pid' belongs to, or 0
+ * @pid: process id
+ */
+int job_of_pid(const pid_t pid)
+{
+    size_t i;
+    int j;
+
+    for (i = 0; i < table.count; i++)
+        for (j = 0; j < table.jobs[i]->count; j++)
+            if (table.jobs[i]->procs[j].pid == pid)
+                return table.jobs[i]->id;
+    return 0;
+}
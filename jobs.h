@@ -0,0 +1,84 @@
+/*
+ * jobs.h - background jobs
+ *
+ * This source code is licensed under the MIT License.
+ * See the file COPYING for more details.
+ *
+ * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
+ */
+
+#ifndef PSH_JOBS_H_
+#define PSH_JOBS_H_
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define JOB_INITIAL_SIZE  8
+#define JOB_POLL_MAX  64
+
+/**
+ * init_jobs - set up the job table
+ * @interactive: announce new jobs and open a pidfd for every process so
+ *               that the input loop can wake up when one exits
+ */
+void init_jobs(const bool interactive);
+
+/**
+ * job_add - remember a pipeline started with '&'
+ * @pids: pid of every stage, -1 for stages which never became a process
+ * @count: number of stages
+ * @text: the command line as typed; a trailing '&' and blanks are dropped
+ * @length: length of `text'
+ *
+ * Returns the new job id, or 0 when no stage is running.
+ */
+int job_add(const pid_t *pids, const int count, const char *text,
+            size_t length);
+
+/**
+ * jobs_reap - collect exited processes of every job without blocking
+ *
+ * Returns how many jobs have finished during this call.
+ */
+int jobs_reap(void);
+
+/**
+ * jobs_pollfds - fill `fds' with the pidfds of running processes
+ * @fds: array of at least `max' entries
+ * @max: size of `fds'
+ *
+ * Returns the number of entries filled.
+ */
+int jobs_pollfds(struct pollfd *fds, const int max);
+
+/**
+ * jobs_notify - report and forget finished jobs
+ * @stream: stream to print to
+ */
+void jobs_notify(FILE *stream);
+
+/**
+ * jobs_print - list every job, then forget the finished ones
+ * @stream: stream to print to
+ */
+void jobs_print(FILE *stream);
+
+/**
+ * job_wait - wait for a job and forget it
+ * @id: job id, or 0 for every job
+ *
+ * Returns the exit status of the job's last stage, EXIT_SUCCESS when
+ * `id' is 0, or -1 when there is no such job.
+ */
+int job_wait(const int id);
+
+/**
+ * job_of_pid - get the id of the job which `pid' belongs to, or 0
+ * @pid: process id
+ */
+int job_of_pid(const pid_t pid);
+
+#endif  // PSH_JOBS_H_
@@ -18,40 +18,41 @@
 #include "parser.h"
 #include "tree.h"
 
-static const node_t *_parse_terminal(parser_t *p, tokenizer_t *t);
-static const node_t *_parse_num(parser_t *p, tokenizer_t *t);
-static const node_t *_parse_letter(parser_t *p, tokenizer_t *t);
-static const node_t *_parse_alphanum(parser_t *p, tokenizer_t *t);
-static const node_t *_parse_env(parser_t *p, tokenizer_t *t);
-static const node_t *_parse_word(parser_t *p, tokenizer_t *t, node_t *parent);
-static const node_t *
-_parse_env_assignment(parser_t *p, tokenizer_t *t, node_t *parent);
-// static const node_t *_parse_home(parser_t *p, tokenizer_t *t, node_t *parent);
-static const node_t *_parse_home(parser_t *p, tokenizer_t *t);
-static const node_t *
-_parse_redirect_out(parser_t *p, tokenizer_t *t, node_t *parent);
-static const node_t *
-_parse_redirect_in(parser_t *p, tokenizer_t *t, node_t *parent);
-static const node_t *
-_parse_redirection(parser_t *p, tokenizer_t *t, node_t *parent);
-static const node_t *
-_parse_command_element(parser_t *p, tokenizer_t *t, node_t *parent);
-static const node_t *
-_parse_redirection_list(parser_t *p, tokenizer_t *t, node_t *parent);
-static const node_t *
-_parse_piped_command(parser_t *p, tokenizer_t *t, node_t *parent);
+static node_id_t _parse_terminal(parser_t *p, tokenizer_t *t);
+static node_id_t _parse_num(parser_t *p, tokenizer_t *t);
+static node_id_t _parse_letter(parser_t *p, tokenizer_t *t);
+static node_id_t _parse_alphanum(parser_t *p, tokenizer_t *t);
+static node_id_t _parse_env(parser_t *p, tokenizer_t *t);
+static node_id_t _parse_subst(parser_t *p, tokenizer_t *t);
+static node_id_t _parse_word(parser_t *p, tokenizer_t *t, node_id_t parent);
+static node_id_t 
+_parse_env_assignment(parser_t *p, tokenizer_t *t, node_id_t parent);
+// static node_id_t _parse_home(parser_t *p, tokenizer_t *t, node_id_t parent);
+static node_id_t _parse_home(parser_t *p, tokenizer_t *t);
+static node_id_t 
+_parse_redirect_out(parser_t *p, tokenizer_t *t, node_id_t parent);
+static node_id_t 
+_parse_redirect_in(parser_t *p, tokenizer_t *t, node_id_t parent);
+static node_id_t 
+_parse_redirection(parser_t *p, tokenizer_t *t, node_id_t parent);
+static node_id_t 
+_parse_command_element(parser_t *p, tokenizer_t *t, node_id_t parent);
+static node_id_t 
+_parse_redirection_list(parser_t *p, tokenizer_t *t, node_id_t parent);
+static node_id_t 
+_parse_piped_command(parser_t *p, tokenizer_t *t, node_id_t parent);
 
 /**
  * init_parsr - Initialize parser and command tables.
+ * @arena: store which holds the parser and the syntax tree
  */
-parser_t *init_parser(void)
+parser_t *init_parser(arena_t *arena)
 {
-    parser_t *p = (parser_t *) malloc(sizeof(parser_t));
-    if (p == NULL) {
-        fprintf(stderr, "Bad allocation (parser) \n");
-        exit(EXIT_FAILURE);
-    }
-    p->root = init_root();
+    parser_t *p = (parser_t *) arena_alloc(arena, sizeof(parser_t));
+
+    p->arena = arena;
+    p->tree = init_tree(arena);
+    init_root(p->tree);
 
     return p;
 }
@@ -63,21 +64,21 @@ parser_t *init_parser(void)
 void syntax_error(parser_t *p, tokenizer_t *t)
 {
     fprintf(stderr, "syntax error: \n");
-    free(t);
-    free_nodes(p->root, p->root);
-    free(p);
     exit(EXIT_FAILURE);
 }
 
-static const node_t *_parse_terminal(parser_t *p, tokenizer_t *t)
+static node_id_t _parse_terminal(parser_t *p, tokenizer_t *t)
 {
     const token_t *_terminal;
-    node_t *terminal;
+    node_id_t terminal;
 
     _terminal = current_token(t);
-    if (!_is_letter(_terminal) && !_is_alphanum(_terminal)
-        && !_is_num(_terminal)  && !_is_env(_terminal))  syntax_error(p, t);
-    terminal = init_node(_terminal);
+    if (!_is_letter(_terminal->spec) && !_is_alphanum(_terminal->spec)
+        && !_is_num(_terminal->spec)  && !_is_env(_terminal->spec)
+        && !_is_subst(_terminal->spec) && !_is_proc_subst(_terminal->spec)
+        && _terminal->spec != WORD)
+        syntax_error(p, t);
+    terminal = init_node(p->tree, _terminal);
 
     return terminal;
 }
@@ -85,7 +86,7 @@ static const node_t *_parse_terminal(parser_t *p, tokenizer_t *t)
 /*
  * _parse_num - Parse <num>
  */
-static const node_t *_parse_num(parser_t *p, tokenizer_t *t)
+static node_id_t _parse_num(parser_t *p, tokenizer_t *t)
 {
     return _parse_terminal(p, t);
 }
@@ -94,7 +95,7 @@ static const node_t *_parse_num(parser_t *p, tokenizer_t *t)
 /*
  * _parse_alphanum - Parse <alphanum>
  */
-static const node_t *_parse_alphanum(parser_t *p, tokenizer_t *t)
+static node_id_t _parse_alphanum(parser_t *p, tokenizer_t *t)
 {
     return _parse_terminal(p, t);
 }
@@ -102,7 +103,7 @@ static const node_t *_parse_alphanum(parser_t *p, tokenizer_t *t)
 /*
  * _parse_letter - Parse <letter>
  */
-static const node_t *_parse_letter(parser_t *p, tokenizer_t *t)
+static node_id_t _parse_letter(parser_t *p, tokenizer_t *t)
 {
     return _parse_terminal(p, t);
 }
@@ -110,74 +111,99 @@ static const node_t *_parse_letter(parser_t *p, tokenizer_t *t)
 /*
  * _parse_env - Parse <env>
  */
-static const node_t *_parse_env(parser_t *p, tokenizer_t *t)
+static node_id_t _parse_env(parser_t *p, tokenizer_t *t)
 {
     return _parse_terminal(p, t);
 }
 
-
+/*
+ * _parse_subst - Parse <subst>
+ */
+static node_id_t _parse_subst(parser_t *p, tokenizer_t *t)
+{
+    return _parse_terminal(p, t);
+}
 
 /*
  * _parse_word - Parse <word>
  */
-static const node_t *_parse_word(parser_t *p, tokenizer_t *t, node_t *parent)
+static node_id_t _parse_word(parser_t *p, tokenizer_t *t, node_id_t parent)
 {
     const token_t *_elh, *_word;
-    const node_t *elh, *word;
-
-    _elh = current_token(t);
-    if (!_is_word(_elh))  syntax_error(p, t);
-    word = NULL;
-    switch (_elh->spec) {
-    case ENV:
-        elh = _parse_env(p, t);
-        break;
-    case ENV_WORD:
-        elh = _parse_env(p, t);
-        _word = next_token(t);
-        if (!_is_word(_word))  syntax_error(p, t);
-        word = _parse_word(p, t, init_abstract_node(WORD));
-        break;
-    case LETTER:
-        elh = _parse_letter(p, t);
-        break;
-    case ALPHANUM:
-        elh = _parse_alphanum(p, t);
-        break;
-    case NUM:
-        elh = _parse_num(p, t);
-        break;
-    case HOME:
-        elh = _parse_home(p, t);
-        break;
-    case HOME_WORD:
-        elh = _parse_home(p, t);
-        _word = next_token(t);
-        if (!_is_word(_word))  syntax_error(p, t);
-        word = _parse_word(p, t, init_abstract_node(WORD));
-        break;
-    default:
-        break;
+    node_id_t elh, word, current = parent;
+
+    for (;;) {
+        _elh = current_token(t);
+        if (!_is_word(_elh->spec))  syntax_error(p, t);
+        elh = word = NO_NODE;
+        switch (_elh->spec) {
+        case ENV:
+            elh = _parse_env(p, t);
+            break;
+        case ENV_WORD:
+            elh = _parse_env(p, t);
+            _word = next_token(t);
+            if (!_is_word(_word->spec))  syntax_error(p, t);
+            word = init_abstract_node(p->tree, WORD);
+            break;
+        case SUBST: case PROC_SUBST_IN: case PROC_SUBST_OUT:
+            elh = _parse_subst(p, t);
+            break;
+        case SUBST_WORD: case PROC_SUBST_IN_WORD: case PROC_SUBST_OUT_WORD:
+            elh = _parse_subst(p, t);
+            _word = next_token(t);
+            if (!_is_word(_word->spec))  syntax_error(p, t);
+            word = init_abstract_node(p->tree, WORD);
+            break;
+        case LETTER:
+            elh = _parse_letter(p, t);
+            break;
+        case WORD:  // a run which an expansion carries on
+            elh = _parse_letter(p, t);
+            _word = next_token(t);
+            if (!_is_word(_word->spec))  syntax_error(p, t);
+            word = init_abstract_node(p->tree, WORD);
+            break;
+        case ALPHANUM:
+            elh = _parse_alphanum(p, t);
+            break;
+        case NUM:
+            elh = _parse_num(p, t);
+            break;
+        case HOME:
+            elh = _parse_home(p, t);
+            break;
+        case HOME_WORD:
+            elh = _parse_home(p, t);
+            _word = next_token(t);
+            if (!_is_word(_word->spec))  syntax_error(p, t);
+            word = init_abstract_node(p->tree, WORD);
+            break;
+        default:
+            break;
+        }
+
+        create_tree(p->tree, current, elh, word);
+        if (word == NO_NODE)  break;
+        current = word;
     }
     
-    create_tree(parent, elh, word);
-    
     return parent;
 }
 
 /*
  * _parse_env_assignment - Parse <env_assignment>
  */
-static const node_t *
-_parse_env_assignment(parser_t *p, tokenizer_t *t, node_t *parent)
+static node_id_t 
+_parse_env_assignment(parser_t *p, tokenizer_t *t, node_id_t parent)
 {
     const token_t *_env_assignment;
-    const node_t *env_assignment;
+    node_id_t env_assignment;
     
     _env_assignment = current_token(t);
-    if (!_is_env_assignment(_env_assignment))  syntax_error(p, t);
-    env_assignment = init_node(_env_assignment);
-    create_tree(parent, env_assignment, NULL);
+    if (!_is_env_assignment(_env_assignment->spec))  syntax_error(p, t);
+    env_assignment = init_node(p->tree, _env_assignment);
+    create_tree(p->tree, parent, env_assignment, NO_NODE);
     
     return parent;
 }
@@ -185,13 +211,13 @@ _parse_env_assignment(parser_t *p, tokenizer_t *t, node_t *parent)
 /*
  * _parse_home - Parse <home>
  */
-static const node_t *_parse_home(parser_t *p, tokenizer_t *t)
+static node_id_t _parse_home(parser_t *p, tokenizer_t *t)
 {    
     const token_t *_home = current_token(t);
-    const node_t *home;
+    node_id_t home;
 
-    if (!_is_home(_home))  syntax_error(p, t);
-    home = init_node(_home);
+    if (!_is_home(_home->spec))  syntax_error(p, t);
+    home = init_node(p->tree, _home);
     
     return home;
 }
@@ -199,20 +225,27 @@ static const node_t *_parse_home(parser_t *p, tokenizer_t *t)
 /*
  * _parse_redirect_in - Parse <redirect_in>
  */
-static const node_t *
-_parse_redirect_in(parser_t *p, tokenizer_t *t, node_t *parent)
+static node_id_t 
+_parse_redirect_in(parser_t *p, tokenizer_t *t, node_id_t parent)
 {
     const token_t *_redirect_in, *_word;
+    bool heredoc;
     // node_t *redirect_in;
-    const node_t *word;
 
     _redirect_in = current_token(t);
-    if (!_is_redirect_in(_redirect_in))  syntax_error(p, t);
+    if (!_is_redirect_in(_redirect_in->spec))  syntax_error(p, t);
     
+    heredoc = (_redirect_in->spec == HEREDOC);  // the token is about to change
     _word = next_token(t);
-    if (!_is_word(_word))  syntax_error(p, t);
-    word = _parse_word(p, t, parent);
-    // create_tree(parent, redirect_in, NULL);
+    if (heredoc) {
+        // The body stands in for the word and is never expanded.
+        if (_word->spec != HEREDOC_BODY)  syntax_error(p, t);
+        create_tree(p->tree, parent, init_node(p->tree, _word), NO_NODE);
+        return parent;
+    }
+    if (!_is_word(_word->spec))  syntax_error(p, t);
+    _parse_word(p, t, parent);
+    // create_tree(p->tree, parent, redirect_in, NO_NODE);
 
     return parent;
 }
@@ -220,24 +253,30 @@ _parse_redirect_in(parser_t *p, tokenizer_t *t, node_t *parent)
 /*
  * _parse_redirect_out - Parse <redirect_out>
  */
-static const node_t *_parse_redirect_out(parser_t *p, tokenizer_t *t, node_t *parent)
+static node_id_t _parse_redirect_out(parser_t *p, tokenizer_t *t, node_id_t parent)
 {
     const token_t *_redirect_out, *_wn;
     // node_t *redirect_out;
-    const node_t *wn;
+    node_id_t wn;
     
     _redirect_out = current_token(t);
-    if (!_is_redirect_out(_redirect_out))  syntax_error(p, t);
+    if (!_is_redirect_out(_redirect_out->spec))  syntax_error(p, t);
     switch (_redirect_out->spec) {
     case REDIRECT_OUT_COMPOSITION:
         _wn = next_token(t);
-        if (!_is_num(_wn))  break; // syntax_error(p, t);
-        wn = _parse_num(p, t);
-        create_tree(parent, wn, NULL);
+        if (_is_num(_wn->spec)) {
+            wn = _parse_num(p, t);
+            create_tree(p->tree, parent, wn, NO_NODE);
+        } else if (_is_word(_wn->spec)) {
+            // ">& file" sends both stdout and stderr to the file.
+            wn = _parse_word(p, t, parent);
+        } else {
+            syntax_error(p, t);
+        }
         break;
     case REDIRECT_OUT: case REDIRECT_OUT_APPEND:
         _wn = next_token(t);
-        if (!_is_word(_wn))  syntax_error(p, t);
+        if (!_is_word(_wn->spec))  syntax_error(p, t);
         wn = _parse_word(p, t, parent);
         break;
     default:
@@ -250,43 +289,45 @@ static const node_t *_parse_redirect_out(parser_t *p, tokenizer_t *t, node_t *pa
 /*
  * _parse_redirection - Parse <redirection>
  */
-static const node_t *
-_parse_redirection(parser_t *p, tokenizer_t *t, node_t *parent)
+static node_id_t 
+_parse_redirection(parser_t *p, tokenizer_t *t, node_id_t parent)
 {
     const token_t *_redirection;
-    const node_t *redirection;
+    node_id_t redirection;
 
     _redirection = current_token(t);
-    if (!_is_redirection(_redirection))  syntax_error(p, t);
+    if (!_is_redirection(_redirection->spec))  syntax_error(p, t);
     switch (_redirection->spec) {
     case REDIRECT_OUT_PATTERN:
-        redirection = _parse_redirect_out(p, t, init_node(_redirection));
+        redirection = _parse_redirect_out(
+            p, t, init_node(p->tree, _redirection));
         break;
     case REDIRECT_IN_PATTERN:
         redirection = _parse_redirect_in(
-            p, t, init_node(_redirection));
+            p, t, init_node(p->tree, _redirection));
         break;
     default:
-        redirection = NULL;
+        redirection = NO_NODE;
     }
     
-    create_tree(parent, redirection, NULL);
+    create_tree(p->tree, parent, redirection, NO_NODE);
     return parent;
 }
 
 /*
  * _parse_redirection_list - Parse <redirection_list>
  */
-static const node_t *
-_parse_redirection_list(parser_t *p, tokenizer_t *t, node_t *parent)
+static node_id_t 
+_parse_redirection_list(parser_t *p, tokenizer_t *t, node_id_t parent)
 {
-    const token_t *_redirection, *_redirection_list;
-    const node_t *redirection, *redirection_list;
+    const token_t *_redirection;
+    node_id_t redirection;
     
     _redirection = current_token(t);
-    if (!_is_redirection(_redirection))  syntax_error(p, t);
-    redirection = _parse_redirection(p, t, init_abstract_node(REDIRECTION));
-    create_tree(parent, redirection, NULL);
+    if (!_is_redirection(_redirection->spec))  syntax_error(p, t);
+    redirection = _parse_redirection(
+        p, t, init_abstract_node(p->tree, REDIRECTION));
+    create_tree(p->tree, parent, redirection, NO_NODE);
 
     return parent;
 }
@@ -294,64 +335,85 @@ _parse_redirection_list(parser_t *p, tokenizer_t *t, node_t *parent)
 /*
  * _parse_command_element - Parse <command_element>
  */
-static const node_t *
-_parse_command_element(parser_t *p, tokenizer_t *t, node_t *parent)
+static node_id_t 
+_parse_command_element(parser_t *p, tokenizer_t *t, node_id_t parent)
 {
     const token_t *_wer, *_command_element;
-    const node_t *wer, *command_element;
+    node_id_t wer, command_element, current = parent;
     
-    _wer = current_token(t);
-    if (!_is_command_element(_wer))  syntax_error(p, t);
-    switch (_wer->spec) {
-    case WORD_PATTERN:
-        wer = _parse_word(p, t, init_abstract_node(WORD));
-        break;
-    case ENV_ASSIGNMENT:
-        wer = _parse_env_assignment(p, t, init_abstract_node(ENV_ASSIGNMENT));
-        break;
-    case REDIRECT_PATTERN:
-        wer = _parse_redirection_list(p, t, init_abstract_node(REDIRECTION_LIST));
-        break;
-    default: break;
+    for (;;) {
+        _wer = current_token(t);
+        if (!_is_command_element(_wer->spec))  syntax_error(p, t);
+        wer = NO_NODE;
+        switch (_wer->spec) {
+        case WORD_PATTERN:
+            wer = _parse_word(p, t, init_abstract_node(p->tree, WORD));
+            break;
+        case ENV_ASSIGNMENT:
+            wer = _parse_env_assignment(
+                p, t, init_abstract_node(p->tree, ENV_ASSIGNMENT));
+            break;
+        case REDIRECT_PATTERN:
+            wer = _parse_redirection_list(
+                p, t, init_abstract_node(p->tree, REDIRECTION_LIST));
+            break;
+        default: break;
+        }
+
+        _command_element = next_token(t);
+        // An unterminated "$(", '`' or "<(" would swallow the rest.
+        if (_is_error(_command_element->spec))  syntax_error(p, t);
+        if (_is_command_element(_command_element->spec))
+            command_element = init_abstract_node(p->tree, COMMAND_ELEMENT);
+        else
+            command_element = NO_NODE;
+
+        create_tree(p->tree, current, wer, command_element);
+        if (command_element == NO_NODE)  break;
+        current = command_element;
     }
     
-    _command_element = next_token(t);
-    if (_command_element != NULL && _is_command_element(_command_element))
-        command_element = _parse_command_element(
-            p, t, init_abstract_node(COMMAND_ELEMENT));
-    else
-        command_element = NULL;
-    
-    create_tree(parent, wer, command_element);
-    
     return parent;
 }
 
 /*
  * _parse_command - Parse <command> and make pipe.
  */
-static const node_t *
-_parse_piped_command(parser_t *p, tokenizer_t *t, node_t *parent)
+static node_id_t 
+_parse_piped_command(parser_t *p, tokenizer_t *t, node_id_t parent)
 {
     const token_t *_command_element, *_command;
-    const node_t *command_element, *command;
+    node_id_t command_element, command, current = parent;
     
     _command_element = current_token(t);
-    if (_is_eof(_command_element) || _is_eol(_command_element)) {
-        command_element = init_node(_command_element);
-        create_tree(parent, command_element, NULL);
+    if (_is_eof(_command_element->spec) || _is_eol(_command_element->spec)) {
+        command_element = init_node(p->tree, _command_element);
+        create_tree(p->tree, parent, command_element, NO_NODE);
         return parent;
     }
     
-    if (!_is_command_element(_command_element))  syntax_error(p, t);
-    command_element = _parse_command_element(
-        p, t, init_abstract_node(COMMAND_ELEMENT));
-    _command = next_token(t);
-    if (_is_command_element(_command))
-        command = _parse_piped_command(p, t, init_abstract_node(COMMAND));
-    else
-        command = NULL;
-    create_tree(parent, command_element, command);
+    for (;;) {
+        _command_element = current_token(t);
+        if (!_is_command_element(_command_element->spec))  syntax_error(p, t);
+        command_element = _parse_command_element(
+            p, t, init_abstract_node(p->tree, COMMAND_ELEMENT));
+        if (_is_background(current_token(t)->spec)) {
+            // '&' may only end the line.
+            p->tree->background = true;
+            _command = next_token(t);
+            if (!_is_eof(_command->spec) && !_is_eol(_command->spec))
+                syntax_error(p, t);
+        } else {
+            _command = next_token(t);
+        }
+        if (_is_command_element(_command->spec))
+            command = init_abstract_node(p->tree, COMMAND);
+        else
+            command = NO_NODE;
+        create_tree(p->tree, current, command_element, command);
+        if (command == NO_NODE)  break;
+        current = command;
+    }
     
     return parent;
 }
@@ -360,8 +422,10 @@ _parse_piped_command(parser_t *p, tokenizer_t *t, node_t *parent)
  * parse_input - Parse and set command information to command tables
  * @t: Token information and next character.
  */
-const node_t *parse_input(parser_t *p, tokenizer_t *t)
+tree_t *parse_input(parser_t *p, tokenizer_t *t)
 {
-    const node_t *root = _parse_piped_command(p, t, p->root);
-    return root;
+    p->tree->source = t->input;
+    p->tree->source_length = t->length;
+    _parse_piped_command(p, t, p->tree->root);
+    return p->tree;
 }
@@ -16,164 +16,205 @@
 
 #define REDIRECT_PATTERN   \
     REDIRECTION_LIST: case REDIRECTION: case REDIRECT_IN: case REDIRECT_IN_OUT:  \
+ case HEREDOC: case HERE_STRING:  \
  case REDIRECT_OUT: case REDIRECT_OUT_APPEND: case REDIRECT_OUT_COMPOSITION
 
 #define REDIRECT_IN_PATTERN   \
-    REDIRECT_IN: case REDIRECT_IN_OUT
+    REDIRECT_IN: case REDIRECT_IN_OUT: case HEREDOC: case HERE_STRING
 
 #define REDIRECT_OUT_PATTERN  \
     REDIRECT_OUT: case REDIRECT_OUT_APPEND: case REDIRECT_OUT_COMPOSITION
 
 #define WORD_PATTERN  \
-    WORD: case ENV: case ENV_WORD: case LETTER: case ALPHANUM:  \
-    case NUM: case HOME: case HOME_WORD
+    WORD: case ENV: case ENV_WORD: case SUBST: case SUBST_WORD:  \
+    case PROC_SUBST_IN: case PROC_SUBST_IN_WORD:  \
+    case PROC_SUBST_OUT: case PROC_SUBST_OUT_WORD:  \
+    case LETTER: case ALPHANUM: case NUM: case HOME: case HOME_WORD
 
 typedef struct parser {
-    node_t *root;
+    tree_t *tree;
+    arena_t *arena;
 } parser_t;
 
 /*
- * _is_num - chech whether token is <num>
+ * _is_num - chech whether token spec is <num>
  */
-static inline const bool _is_num(const token_t *t)
+static inline const bool _is_num(const token_spec_t spec)
 {
-    return (t->spec == NUM) ? true : false;
+    return (spec == NUM) ? true : false;
 }
 
 /*
- * _is_alpha - chech whether token is <alpha>
+ * _is_alpha - chech whether token spec is <alpha>
  */
-static inline const bool _is_alphanum(const token_t *t)
+static inline const bool _is_alphanum(const token_spec_t spec)
 {
-    return (_is_num(t) || t->spec == ALPHANUM) ? true : false;
+    return (_is_num(spec) || spec == ALPHANUM) ? true : false;
 }
 
 /*
- * _is_letter - chech whether token is <letter>
+ * _is_letter - chech whether token spec is <letter>
  */
-static inline const bool _is_letter(const token_t *t)
+static inline const bool _is_letter(const token_spec_t spec)
 {
-    return (_is_alphanum(t) || t->spec == LETTER) ? true : false;
+    return (_is_alphanum(spec) || spec == LETTER) ? true : false;
 }
 
 /*
- * _is_word - chech whether token is <word>
+ * _is_word - chech whether token spec is <word>
  */
-static inline const bool _is_env(const token_t *t)
+static inline const bool _is_env(const token_spec_t spec)
 {
-    return (t->spec == ENV || t->spec == ENV_WORD) ? true : false;
+    return (spec == ENV || spec == ENV_WORD) ? true : false;
 }
 
 /*
- * _is_home - chech whether token is <home>
+ * _is_subst - chech whether token spec is <subst>
  */
-static inline const bool _is_home(const token_t *t)
+static inline const bool _is_subst(const token_spec_t spec)
 {
-    return (t->spec == HOME || t->spec == HOME_WORD) ? true : false;
+    return (spec == SUBST || spec == SUBST_WORD) ? true : false;
 }
 
 /*
- * _is_word - chech whether token is <word>
+ * _is_proc_subst - chech whether token spec is <proc_subst>
  */
-static inline const bool _is_word(const token_t *t)
+static inline const bool _is_proc_subst(const token_spec_t spec)
 {
-    return (t->spec == WORD || _is_env(t) || _is_letter(t) || _is_home(t)) ? true : false;
+    return (spec == PROC_SUBST_IN || spec == PROC_SUBST_IN_WORD ||
+            spec == PROC_SUBST_OUT ||
+            spec == PROC_SUBST_OUT_WORD) ? true : false;
 }
 
 /*
- * _is_redirect_in - chech whether token is <redirect_in>
+ * _is_home - chech whether token spec is <home>
  */
-static inline const bool _is_redirect_in(const token_t *t)
+static inline const bool _is_home(const token_spec_t spec)
 {
-    return (t->spec == REDIRECT_IN ||
-            t->spec == REDIRECT_IN_OUT) ? true : false;
+    return (spec == HOME || spec == HOME_WORD) ? true : false;
 }
 
 /*
- * _is_redirect_out - chech whether token is <redirect_out>
+ * _is_word - chech whether token spec is <word>
  */
-static inline const bool _is_redirect_out(const token_t *t)
+static inline const bool _is_word(const token_spec_t spec)
 {
-    return (t->spec == REDIRECT_OUT ||
-            t->spec == REDIRECT_OUT_COMPOSITION ||
-            t->spec == REDIRECT_OUT_APPEND) ? true : false;
+    return (spec == WORD || _is_env(spec) || _is_subst(spec) ||
+            _is_proc_subst(spec) || _is_letter(spec) ||
+            _is_home(spec)) ? true : false;
 }
 
 /*
- * _is_redirection - chech whether token is <redirection>
+ * _is_redirect_in - chech whether token spec is <redirect_in>
  */
-static inline const bool _is_redirection(const token_t *t)
+static inline const bool _is_redirect_in(const token_spec_t spec)
 {
-    return (_is_redirect_in(t) || _is_redirect_out(t)) ? true : false;
+    return (spec == REDIRECT_IN || spec == REDIRECT_IN_OUT ||
+            spec == HEREDOC || spec == HERE_STRING) ? true : false;
 }
 
 /*
- * _is_redirection_list - chech whether token is <redirection_list>
+ * _is_redirect_out - chech whether token spec is <redirect_out>
  */
-static inline const bool _is_redirection_list(const token_t *t)
+static inline const bool _is_redirect_out(const token_spec_t spec)
 {
-    return (_is_redirection(t)) ? true : false;
+    return (spec == REDIRECT_OUT ||
+            spec == REDIRECT_OUT_COMPOSITION ||
+            spec == REDIRECT_OUT_APPEND) ? true : false;
 }
 
 /*
- * _is_env_assignment - chech whether token is <env_assignment>
+ * _is_redirection - chech whether token spec is <redirection>
  */
-static inline const bool _is_env_assignment(const token_t *t)
+static inline const bool _is_redirection(const token_spec_t spec)
 {
-    return (t->spec == ENV_ASSIGNMENT) ? true : false;
+    return (_is_redirect_in(spec) || _is_redirect_out(spec)) ? true : false;
 }
 
 /*
- * _is_command_element - chech whether token is <command_element>
+ * _is_redirection_list - chech whether token spec is <redirection_list>
  */
-static inline const bool _is_command_element(const token_t *t)
+static inline const bool _is_redirection_list(const token_spec_t spec)
 {
-    return (t->spec == COMMAND_ELEMENT ||
-            _is_word(t) ||
-            _is_env_assignment(t) ||
-            _is_redirection(t)) ? true : false;
+    return (_is_redirection(spec)) ? true : false;
 }
 
 /*
- * _is_command - chech whether token is <command>
+ * _is_env_assignment - chech whether token spec is <env_assignment>
  */
-static inline const bool _is_command(const token_t *t)
+static inline const bool _is_env_assignment(const token_spec_t spec)
 {
-    // return (_is_command_element(t)) ? true : false;
-    return (t->spec == COMMAND || _is_command_element(t)) ? true : false;
+    return (spec == ENV_ASSIGNMENT) ? true : false;
 }
 
 /*
- * _is_piped_command - chech whether token is <piped_command>
+ * _is_command_element - chech whether token spec is <command_element>
  */
-static inline const bool _is_piped_command(const token_t *t)
+static inline const bool _is_command_element(const token_spec_t spec)
 {
-    // return (_is_command(t)) ? true : false;
-    return (t->spec == PIPED_COMMAND || _is_command(t)) ? true : false;
+    return (spec == COMMAND_ELEMENT ||
+            _is_word(spec) ||
+            _is_env_assignment(spec) ||
+            _is_redirection(spec)) ? true : false;
+}
+
+/*
+ * _is_command - chech whether token spec is <command>
+ */
+static inline const bool _is_command(const token_spec_t spec)
+{
+    // return (_is_command_element(spec)) ? true : false;
+    return (spec == COMMAND || _is_command_element(spec)) ? true : false;
+}
+
+/*
+ * _is_piped_command - chech whether token spec is <piped_command>
+ */
+static inline const bool _is_piped_command(const token_spec_t spec)
+{
+    // return (_is_command(spec)) ? true : false;
+    return (spec == PIPED_COMMAND || _is_command(spec)) ? true : false;
 }
 
 
 /*
- * _is_eol - chech whether token is '\n'
+ * _is_eol - chech whether token spec is '\n'
  */
-static inline const bool _is_eol(const token_t *t)
+static inline const bool _is_eol(const token_spec_t spec)
 {
-    return (t->spec == END_OF_LINE) ? true : false;
+    return (spec == END_OF_LINE) ? true : false;
 }
 
 
 /*
- * _is_eol - chech whether token is '\n'
+ * _is_background - chech whether token spec is '&'
+ */
+static inline const bool _is_background(const token_spec_t spec)
+{
+    return (spec == BACKGROUND) ? true : false;
+}
+
+/*
+ * _is_error - chech whether token spec is an unterminated <subst>
+ */
+static inline const bool _is_error(const token_spec_t spec)
+{
+    return (spec == ERROR) ? true : false;
+}
+
+/*
+ * _is_eol - chech whether token spec is '\n'
  */
-static inline const bool _is_eof(const token_t *t)
+static inline const bool _is_eof(const token_spec_t spec)
 {
-    return (t->spec == END_OF_FILE) ? true : false;
+    return (spec == END_OF_FILE) ? true : false;
 }
 
 /**
  * init_parser - Initialize parser and command tables.
+ * @arena: store which holds the parser and the syntax tree
  */
-parser_t *init_parser(void);
+parser_t *init_parser(arena_t *arena);
 
 /**
  * syntax_error - Deal with syntax error of input.
@@ -187,6 +228,6 @@ void syntax_error(parser_t *p, tokenizer_t *t);
  * @p: Parser and command tables
  * @t: Token information and next character.
  */
-const node_t *parse_input(parser_t *p, tokenizer_t *t);
+tree_t *parse_input(parser_t *p, tokenizer_t *t);
 
 #endif  // PSH_PARSER_H_
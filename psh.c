@@ -7,6 +7,10 @@
  * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <readline/readline.h>
@@ -19,6 +23,10 @@
 
 #include "consts.h"
 #include "executor.h"
+#include "fd.h"
+#include "jobs.h"
+#include "reader.h"
+#include "vars.h"
 
 char *readline(const char *prompt);
 
@@ -45,35 +53,224 @@ static void say_hello()
     printf("%s", ctime(&timer));
 }
 
-static void finalize(tokenizer_t *t, parser_t *p, node_t *root)
+/*
+ * finalize - release everything the line allocated, optionally reporting
+ * how much it was when PSH_ARENA_STATS is set
+ */
+static void finalize(arena_t *arena, const bool stats)
 {
-    free(t);
-    free(p);
-    free_nodes(root, root);
+    if (stats)
+        fprintf(stderr, "psh: arena: %zu allocations, %zu bytes, %zu chunks\n",
+                arena->allocs, arena->bytes, arena->chunks);
+    arena_reset(arena);
 }
     
-int main(int argc, char **argv)
+/*
+ * run_line - tokenize, parse and execute one line of input
+ *
+ * `input' holds `length' bytes and need not be NUL terminated.  `last'
+ * tells that no line follows, so the final command may take over the
+ * shell process.  Returns the exit status of the line, or `status' when
+ * it was empty.
+ */
+static int run_line(arena_t *arena, const char *input, const size_t length,
+                    int status, const bool last, const bool stats,
+                    const bool fd_debug)
 {
     tokenizer_t *t;
     parser_t *p;
-    node_t *root;
-    // char input[INPUT_MAX], prompt[100];
+    tree_t *tree;
+    int result;
+
+    t = init_tokenizer_slice(arena, input, length);
+    p = init_parser(arena);
+    tree = parse_input(p, t);
+    result = eat_root(tree, last && !stats && !fd_debug);
+    if (fd_debug)  fd_report(stderr);
+    finalize(arena, stats);
+
+    return (result == -1) ? status : result;
+}
+
+static char *input_line;  // set by the readline line handler
+static bool input_ready;
+
+/*
+ * _line_handler - take a finished line, or NULL at EOF, from readline
+ */
+static void _line_handler(char *line)
+{
+    input_line = line;
+    input_ready = true;
+    rl_callback_handler_remove();
+}
+
+/*
+ * _read_input - read a line while reaping background jobs as they exit
+ *
+ * readline is driven through its callback interface so that one poll()
+ * waits on the terminal and on the pidfds of running jobs together.  A
+ * job which finishes while a line is being typed is reported at once and
+ * the line is drawn again below the notice.  Returns NULL at EOF.
+ */
+static char *_read_input(const char *prompt)
+{
+    struct pollfd fds[1 + JOB_POLL_MAX];
+    int nfds;
+
+    input_ready = false;
+    input_line = NULL;
+    rl_callback_handler_install(prompt, _line_handler);
+    while (!input_ready) {
+        fds[0].fd = STDIN_FILENO;
+        fds[0].events = POLLIN;
+        nfds = 1 + jobs_pollfds(fds + 1, JOB_POLL_MAX);
+        if (poll(fds, nfds, -1) == -1) {
+            if (errno == EINTR)  continue;
+            rl_callback_handler_remove();
+            break;
+        }
+        if (nfds > 1 && jobs_reap() > 0) {
+            putchar('\n');
+            fflush(stdout);
+            jobs_notify(stderr);
+            rl_on_new_line();
+            rl_redisplay();
+        }
+        if (fds[0].revents != 0)
+            rl_callback_read_char();
+    }
+
+    return input_line;
+}
+
+/*
+ * _read_heredocs - append the bodies of the here-documents `input' opens
+ *
+ * Body lines are read with a "> " prompt up to each delimiter line.
+ * Returns the whole statement, which `input' may have been moved into.
+ */
+static char *_read_heredocs(char *input)
+{
+    const size_t first = strlen(input);
+    size_t scan = 0, length = first, delimiter_length, delimiter_offset;
+    const char *delimiter;
+    char *line, *statement;
+
+    while (next_heredoc(input, first, &scan, &delimiter, &delimiter_length)) {
+        delimiter_offset = delimiter - input;
+        while ((line = _read_input("> ")) != NULL) {
+            statement = (char *) realloc(input, length + strlen(line) + 2);
+            if (statement == NULL) {
+                fprintf(stderr, "Bad allocation (psh) \n");
+                exit(EXIT_FAILURE);
+            }
+            input = statement;
+            input[length++] = '\n';
+            strcpy(input + length, line);
+            length += strlen(line);
+            if (strlen(line) == delimiter_length
+                && memcmp(line, input + delimiter_offset,
+                          delimiter_length) == 0) {
+                free(line);
+                break;
+            }
+            free(line);
+        }
+    }
+
+    return input;
+}
+
+/*
+ * run_interactive - read lines through readline with greeting and prompt
+ */
+static int run_interactive(arena_t *arena, const bool stats,
+                           const bool fd_debug)
+{
     char *input;
     char prompt[ELEMENT_MAX];
-    
+    int status = EXIT_SUCCESS;
+
     say_hello();
-    sprintf(prompt, "%s [0;32m%s$[0;37m ",
-            getenv("USER"), getcwd(NULL, 1024));
-    while (input = readline(prompt)) {
-        rl_bind_key('\t', rl_complete);
+    rl_bind_key('\t', rl_complete);
+    sprintf(prompt, "%s [0;32m%s$[0;37m ",
+            var_get("USER"), getcwd(NULL, 1024));
+    while ((input = _read_input(prompt)) != NULL) {
         add_history(input);
-        t = init_tokenizer(input);
-        p = init_parser();
-        root = (node_t *)parse_input(p, t);
-        eat_root(root);
-        finalize(t, p, root);
-        sprintf(prompt, "%s [0;32m%s$[0;37m ",
-                getenv("USER"), getcwd(NULL, 1024));
+        input = _read_heredocs(input);
+        status = run_line(arena, input, strlen(input), status, false,
+                          stats, fd_debug);
+        free(input);
+        jobs_reap();
+        jobs_notify(stderr);
+        sprintf(prompt, "%s [0;32m%s$[0;37m ",
+                var_get("USER"), getcwd(NULL, 1024));
+    }
+
+    return status;
+}
+
+/*
+ * run_script - run a script statement by statement
+ *
+ * Used for -c, script files and a non-terminal stdin; readline is never
+ * initialized and no prompt is formatted.  Each statement runs as soon
+ * as it has been read, so a long script starts at once.
+ */
+static int run_script(arena_t *arena, reader_t *r, const bool stats,
+                      const bool fd_debug)
+{
+    int status = EXIT_SUCCESS;
+    bool last;
+
+    while (reader_next(r)) {
+        jobs_reap();
+        // Only a script which is all in memory can tell that this is
+        // the last statement; on a pipe the statement must not wait for
+        // the next one to arrive.
+        last = reader_complete(r) && !reader_more(r);
+        status = run_line(arena, reader_line(r), r->line_length, status,
+                          last, stats, fd_debug);
+    }
+    free_reader(r);
+
+    return status;
+}
+
+extern char **environ;
+
+int main(int argc, char **argv)
+{
+    arena_t *arena = init_arena();
+    const bool stats = (getenv("PSH_ARENA_STATS") != NULL);
+    const bool fd_debug = (getenv("PSH_FD_DEBUG") != NULL);
+    int script, status;
+
+    init_vars(environ);
+    init_jobs(argc == 1 && isatty(STDIN_FILENO));
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "psh: -c: option requires an argument\n");
+            return 2;
+        }
+        status = run_script(arena, init_string_reader(argv[2]),
+                            stats, fd_debug);
+    } else if (argc > 1) {
+        script = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (script == -1) {
+            fprintf(stderr, "psh: %s: %s\n", argv[1], strerror(errno));
+            return 127;
+        }
+        fd_hold(script);
+        status = run_script(arena, init_reader(script), stats, fd_debug);
+        fd_close(script);
+    } else if (!isatty(STDIN_FILENO)) {
+        status = run_script(arena, init_reader(STDIN_FILENO), stats, fd_debug);
+    } else {
+        status = run_interactive(arena, stats, fd_debug);
     }
-    return 0;
+    free_arena(arena);
+
+    return status;
 }
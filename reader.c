@@ -0,0 +1,223 @@
+/*
+ * reader.c - read a script one statement at a time
+ *
+ * This source code is licensed under the MIT License.
+ * See the file COPYING for more details.
+ *
+ * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "reader.h"
+#include "tokenizer.h"
+
+/*
+ * _alloc_reader - allocate an empty reader
+ */
+static reader_t *_alloc_reader(const int fd)
+{
+    reader_t *r = (reader_t *) calloc(1, sizeof(reader_t));
+
+    if (r == NULL) {
+        fprintf(stderr, "Bad allocation (reader) \n");
+        exit(EXIT_FAILURE);
+    }
+    r->fd = fd;
+
+    return r;
+}
+
+/**
+ * init_reader - set up reading from `fd'
+ * @fd: descriptor of a script file or pipe
+ */
+reader_t *init_reader(const int fd)
+{
+    reader_t *r = _alloc_reader(fd);
+    struct stat st;
+    void *map;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            r->data = (char *) map;
+            r->capacity = r->end = st.st_size;
+            r->mapped = true;
+            r->eof = true;
+            return r;
+        }
+    }
+    r->data = (char *) malloc(READER_BUFFER_SIZE);
+    if (r->data == NULL) {
+        fprintf(stderr, "Bad allocation (reader) \n");
+        exit(EXIT_FAILURE);
+    }
+    r->capacity = READER_BUFFER_SIZE;
+    r->owned = true;
+
+    return r;
+}
+
+/**
+ * init_string_reader - set up reading from a NUL terminated string
+ * @s: the script, which must outlive the reader
+ */
+reader_t *init_string_reader(const char *s)
+{
+    reader_t *r = _alloc_reader(-1);
+
+    r->data = (char *) s;
+    r->capacity = r->end = strlen(s);
+    r->eof = true;
+
+    return r;
+}
+
+/*
+ * _fill - read more of the script, keeping the current statement
+ *
+ * Returns false when nothing more can be read.
+ */
+static bool _fill(reader_t *r)
+{
+    const size_t keep = (r->line_offset < r->pos) ? r->line_offset : r->pos;
+    char *data;
+    ssize_t n;
+
+    if (r->eof)  return false;
+    if (r->end == r->capacity) {
+        if (keep > 0) {
+            memmove(r->data, r->data + keep, r->end - keep);
+            r->end -= keep;
+            r->pos -= keep;
+            r->line_offset -= keep;
+        } else {
+            data = (char *) realloc(r->data, r->capacity * 2);
+            if (data == NULL) {
+                fprintf(stderr, "Bad allocation (reader) \n");
+                exit(EXIT_FAILURE);
+            }
+            r->data = data;
+            r->capacity *= 2;
+        }
+    }
+    do {
+        n = read(r->fd, r->data + r->end, r->capacity - r->end);
+    } while (n == -1 && errno == EINTR);
+    if (n <= 0) {
+        r->eof = true;
+        return false;
+    }
+    r->end += n;
+
+    return true;
+}
+
+/*
+ * _peek - get the byte at `pos', reading more when needed, or -1 at the end
+ */
+static inline int _peek(reader_t *r)
+{
+    if (r->pos == r->end && !_fill(r))
+        return -1;
+
+    return (unsigned char) r->data[r->pos];
+}
+
+/**
+ * reader_more - check whether another statement follows the current one
+ * @r: reader
+ */
+bool reader_more(reader_t *r)
+{
+    int c;
+
+    for (;;) {
+        c = _peek(r);
+        if (c == ' ' || c == '\t' || c == '\n') {
+            r->pos++;
+        } else if (c == '#') {
+            while ((c = _peek(r)) != -1 && c != '\n')
+                r->pos++;
+        } else {
+            return c != -1;
+        }
+    }
+}
+
+/*
+ * _line_end - find the end of the line starting at `from'
+ *
+ * Offsets are relative to the current statement, since _fill may move
+ * it.  Returns the offset of the newline, or of the end of the script.
+ */
+static size_t _line_end(reader_t *r, size_t from)
+{
+    const char *newline;
+
+    for (;;) {
+        newline = memchr(r->data + r->line_offset + from, '\n',
+                         r->end - r->line_offset - from);
+        if (newline != NULL)
+            return newline - (r->data + r->line_offset);
+        from = r->end - r->line_offset;
+        if (!_fill(r))
+            return from;
+    }
+}
+
+/**
+ * reader_next - move to the next statement, skipping blanks and comments
+ * @r: reader
+ *
+ * A statement is one line, followed by the bodies of the here-documents
+ * it opens.
+ */
+bool reader_next(reader_t *r)
+{
+    const char *delimiter;
+    size_t first, end, start, scan = 0, delimiter_offset, delimiter_length;
+
+    r->line_offset = r->pos;  // the previous statement is done with
+    if (!reader_more(r))  return false;
+    r->line_offset = r->pos;
+    first = end = _line_end(r, 0);
+    while (next_heredoc(r->data + r->line_offset, first, &scan,
+                        &delimiter, &delimiter_length)) {
+        delimiter_offset = delimiter - (r->data + r->line_offset);
+        while (r->line_offset + end < r->end) {
+            start = end + 1;
+            end = _line_end(r, start);
+            if (end - start == delimiter_length
+                && memcmp(r->data + r->line_offset + start,
+                          r->data + r->line_offset + delimiter_offset,
+                          delimiter_length) == 0)
+                break;
+        }
+    }
+    r->pos = r->line_offset + end;
+    r->line_length = end;
+
+    return true;
+}
+
+/**
+ * free_reader - release the mapping or buffer of `r'
+ */
+void free_reader(reader_t *r)
+{
+    if (r->mapped)
+        munmap(r->data, r->capacity);
+    else if (r->owned)
+        free(r->data);
+    free(r);
+}
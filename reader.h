@@ -0,0 +1,93 @@
+/*
+ * reader.h - read a script one statement at a time
+ *
+ * This source code is licensed under the MIT License.
+ * See the file COPYING for more details.
+ *
+ * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
+ */
+
+#ifndef PSH_READER_H_
+#define PSH_READER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define READER_BUFFER_SIZE  (4096*16)
+
+/*
+ * A regular file is mapped as a whole and statements are handed out as
+ * slices of the mapping.  Anything else (pipes, terminals) goes through
+ * a buffer which is refilled by read(2) and only grows when a single
+ * statement does not fit, so memory stays constant however long the
+ * script is.
+ */
+typedef struct reader {
+    int fd;  // -1 for an in-memory string
+    char *data;
+    size_t capacity;
+    size_t end;  // bytes of valid data
+    size_t pos;  // next byte to look at
+    size_t line_offset;  // current statement
+    size_t line_length;
+    bool mapped;
+    bool owned;  // data is a buffer of our own
+    bool eof;
+} reader_t;
+
+/**
+ * init_reader - set up reading from `fd'
+ * @fd: descriptor of a script file or pipe
+ */
+reader_t *init_reader(const int fd);
+
+/**
+ * init_string_reader - set up reading from a NUL terminated string
+ * @s: the script, which must outlive the reader
+ */
+reader_t *init_string_reader(const char *s);
+
+/**
+ * reader_next - move to the next statement, skipping blanks and comments
+ * @r: reader
+ *
+ * Returns false at the end of the script.  The statement is available
+ * through reader_line() until the next call.
+ */
+bool reader_next(reader_t *r);
+
+/**
+ * reader_more - check whether another statement follows the current one
+ * @r: reader
+ *
+ * This may read ahead, which can move the current statement; call
+ * reader_line() afterwards.
+ */
+bool reader_more(reader_t *r);
+
+/**
+ * reader_complete - check whether the rest of the script is in memory
+ * @r: reader
+ *
+ * reader_more() can then answer without waiting for input, as it would
+ * on a pipe or terminal which has not been closed yet.
+ */
+static inline bool reader_complete(const reader_t *r)
+{
+    return r->eof;
+}
+
+/**
+ * reader_line - get the current statement, which is not NUL terminated
+ */
+static inline const char *reader_line(const reader_t *r)
+{
+    return r->data + r->line_offset;
+}
+
+/**
+ * free_reader - release the mapping or buffer of `r'
+ */
+void free_reader(reader_t *r);
+
+#endif  // PSH_READER_H_
@@ -0,0 +1,12 @@
+FOO=bar /usr/bin/env | grep FOO
+echo [$FOO]
+FOO=1 FOO=2 env | grep FOO
+HOME=/x env | grep ^HOME
+BAZ=qux
+echo $BAZ
+env | grep BAZ
+BAZ=over env | grep BAZ
+echo $BAZ
+A=1 B=2 env | grep -c ^[AB]=
+X=y chunked env | grep ^X=
+$PSH $TESTS/lib/last_assignment
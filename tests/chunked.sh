@@ -0,0 +1,7 @@
+chunked /bin/echo -n a b c
+/bin/echo
+chunked /bin/echo -e -- x y
+$TESTS/lib/many_args 200000 > many.sh
+$PSH many.sh
+chunked
+chunked nosuchcommand a b
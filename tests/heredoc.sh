@@ -0,0 +1,17 @@
+cat <<EOF
+line one
+line two
+EOF
+cat <<A <<B
+first
+A
+second
+B
+tr a-z A-Z <<END | wc -l
+x
+y
+END
+cat <<<hello
+wc -c <<<abc
+cat <<EOF
+no end
@@ -0,0 +1,16 @@
+sleep 1 &
+jobs
+wait %1
+echo waited
+echo background &
+wait
+false &
+/bin/sleep 0.2
+jobs
+jobs
+sleep 0.2 | sleep 0.3 &
+jobs
+wait
+jobs
+wait %9
+echo done
@@ -0,0 +1,13 @@
+echo hi > fa > fb | tr a-z A-Z
+cat fa fb
+seq 200000 > fa > fb >> fc | wc -l
+wc -l fa fb fc
+echo again > fa >> fc
+cat fa
+tail -1 fc
+echo lost > nodir/x > fb
+cat fb
+echo both >& fd > fe
+cat fd fe
+$PSH $TESTS/lib/last_multios
+wc -l a b c
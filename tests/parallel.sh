@@ -0,0 +1,7 @@
+parallel -j 3 -k echo x ::: a b c d e
+parallel -k -j 4 seq 2 ::: 1 2
+parallel -j 2 -k sh $TESTS/lib/sleep_echo ::: 3 1 2
+parallel -j 1 nosuchcmd ::: a b
+parallel -j 1 false ::: 1 2
+parallel -u -j 1 echo u ::: 1 2 3
+parallel echo
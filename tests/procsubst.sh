@@ -0,0 +1,13 @@
+cat <(echo hi)
+diff <(seq 3) <(seq 4)
+echo x > >(cat)
+/bin/sleep 0.1
+head -1 <(yes)
+cat <(cat <(echo nested))
+cat <(seq 1000) <(seq 10) | wc -l
+seq 100000 > >(wc -l > count)
+/bin/sleep 0.2
+cat count
+$PSH $TESTS/lib/last_procsubst
+head -1 sorted
+wc -l sorted
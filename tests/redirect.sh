@@ -0,0 +1,12 @@
+echo out > a
+cat a
+echo more >> a
+cat a
+ls /nonexist 2> e
+wc -l < e
+ls /nonexist a >& both
+cat both
+ls /nonexist 2>&1 | wc -l
+cat < a > b
+cat b
+$PSH $TESTS/lib/dangling_composition
@@ -0,0 +1,26 @@
+#!/bin/sh
+#
+# run.sh - run every tests/*.sh through psh and compare with its .out
+#
+# Each script runs in an empty scratch directory with stderr folded into
+# stdout, so a test may create files freely and check error messages.
+
+PSH=$(cd "$(dirname "$0")/.." && pwd)/psh
+TESTS=$(cd "$(dirname "$0")" && pwd)
+failed=0
+
+for script in "$TESTS"/*.sh; do
+    name=$(basename "$script" .sh)
+    [ "$name" = run ] && continue
+    scratch=$(mktemp -d)
+    (cd "$scratch" && PSH="$PSH" TESTS="$TESTS" "$PSH" "$script" 2>&1) > "$scratch.out"
+    if diff -u "$TESTS/$name.out" "$scratch.out"; then
+        echo "ok    $name"
+    else
+        echo "FAIL  $name"
+        failed=$((failed + 1))
+    fi
+    rm -rf "$scratch" "$scratch.out"
+done
+
+[ $failed -eq 0 ]
@@ -0,0 +1,2 @@
+$TESTS/lib/slow_pipe | $PSH
+cat ran
@@ -0,0 +1,14 @@
+echo `echo hello`
+echo $(echo a b)x
+echo --prefix=$(echo /usr)
+echo a/$(echo b) pre`echo mid`post
+echo a$(echo b)$(echo c)d
+echo $(seq 3) | wc -l
+echo `echo $(echo nested)`
+echo $(seq 200000) | wc -c
+echo $(cd /) $(pwd | wc -l)
+echo $(echo x)$(echo y)
+echo a $(echo b | tr b c) d
+cd $(echo /)
+pwd
+echo lib$NOPE/x $NOPE end
@@ -0,0 +1,4 @@
+echo before
+$PSH $TESTS/lib/unterminated_subst
+$PSH $TESTS/lib/unterminated_backquote
+echo after
@@ -7,7 +7,6 @@
  * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
  */
 
-#include <ctype.h>
 #include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,53 +15,178 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+/*
+ * PSH_NO_SIMD builds the scalar scanner alone, as bench/ does to compare.
+ */
+#if !defined(PSH_NO_SIMD)
+#if defined(__SSE2__)
+#define PSH_SSE2
+#endif
+#if defined(__AVX2__)
+#define PSH_AVX2
+#endif
+#endif
+
+#if defined(PSH_SSE2)
+#include <immintrin.h>
+#endif
+
 #include "parser.h"
 
-static token_t *_init_token(token_t *t);
-static void _append_token(token_t *token, const char *c);
+/*
+ * Character classes shared by every scanner.  Each byte belongs to
+ * exactly one class; bytes outside of them (controls, non-ASCII) end
+ * the current token.
+ */
+#define CC_DIGIT     0x001  // 0-9
+#define CC_ALPHA     0x002  // a-z A-Z _
+#define CC_PUNCT     0x004  // <special> except '|' '~' '=' '\\' '&' '`'
+#define CC_TILDE     0x008  // ~
+#define CC_EQUAL     0x010  // =
+#define CC_PIPE      0x020  // |
+#define CC_ESCAPE    0x040  // \\ (backslash)
+#define CC_DOLLAR    0x080  // $
+#define CC_REDIRECT  0x100  // < >
+#define CC_BLANK     0x200  // white spaces including '\n'
+#define CC_AMPERSAND 0x400  // &, which always ends a word
+#define CC_BACKQUOTE 0x800  // `
+
+#define ALNUM_CHARS  (CC_DIGIT | CC_ALPHA)
+#define LETTER_CHARS (ALNUM_CHARS | CC_PUNCT | CC_EQUAL | CC_PIPE)
+#define WORD_CHARS   (LETTER_CHARS | CC_TILDE)
+
+static const unsigned short char_class[256] = {
+    ['0' ... '9'] = CC_DIGIT,
+    ['a' ... 'z'] = CC_ALPHA,
+    ['A' ... 'Z'] = CC_ALPHA,
+    ['_'] = CC_ALPHA,
+    ['!'] = CC_PUNCT, ['"'] = CC_PUNCT, ['#'] = CC_PUNCT, ['%'] = CC_PUNCT,
+    ['&'] = CC_AMPERSAND, ['\''] = CC_PUNCT, ['('] = CC_PUNCT, [')'] = CC_PUNCT,
+    ['*'] = CC_PUNCT, ['+'] = CC_PUNCT, [','] = CC_PUNCT, ['-'] = CC_PUNCT,
+    ['.'] = CC_PUNCT, ['/'] = CC_PUNCT, [':'] = CC_PUNCT, [';'] = CC_PUNCT,
+    ['?'] = CC_PUNCT, ['@'] = CC_PUNCT, ['['] = CC_PUNCT, [']'] = CC_PUNCT,
+    ['^'] = CC_PUNCT, ['`'] = CC_BACKQUOTE, ['{'] = CC_PUNCT, ['}'] = CC_PUNCT,
+    ['~'] = CC_TILDE,
+    ['='] = CC_EQUAL,
+    ['|'] = CC_PIPE,
+    ['\\'] = CC_ESCAPE,
+    ['$'] = CC_DOLLAR,
+    ['<'] = CC_REDIRECT, ['>'] = CC_REDIRECT,
+    [' '] = CC_BLANK, ['\t'] = CC_BLANK, ['\n'] = CC_BLANK,
+    ['\v'] = CC_BLANK, ['\f'] = CC_BLANK, ['\r'] = CC_BLANK,
+};
+
+/*
+ * _char_class - get the class of character `c'
+ */
+static inline unsigned short _char_class(const char c)
+{
+    return char_class[(unsigned char) c];
+}
+
+/*
+ * _is_class - check whether character `c' belongs to one of `mask'
+ */
+static inline bool _is_class(const char c, const unsigned short mask)
+{
+    return (_char_class(c) & mask) ? true : false;
+}
+
+static token_t *_init_token(tokenizer_t *t);
+static size_t _skip_run(tokenizer_t *t, const unsigned short mask);
+static const token_t *_scan_run(tokenizer_t *t, const token_spec_t spec,
+                                const unsigned short mask);
+static void _append_token(tokenizer_t *t);
 static const token_t *_scan_word(tokenizer_t *t);
 static const token_t *_scan_alphanum(tokenizer_t *t);
 static const token_t *_scan_only_alphanum(tokenizer_t *t);
 static const token_t *_scan_letter(tokenizer_t *t);
 static const token_t *_scan_num(tokenizer_t *t);
 static const token_t *_scan_env(tokenizer_t *t);
+static const token_t *_scan_subst(tokenizer_t *t, const char close);
+static const token_t *_scan_proc_subst(tokenizer_t *t);
 static const token_t *_scan_home(tokenizer_t *t);
 static const token_t *_scan_env_assignment(tokenizer_t *t);
 static const token_t *_scan_redirect_in(tokenizer_t *t);
 static const token_t *_scan_redirect_out(tokenizer_t *t);
 
 /*
- * _getc - get a character from input
+ * _peek - get the character at `pos', or '\0' past the end of the input
+ *
+ * The input need not be NUL terminated, so a slice of a mapped script
+ * can be scanned where it lies.
  */
-static const char _getc(char *input)
+static inline char _peek(const tokenizer_t *t, const size_t pos)
 {
-    const char c = input[0];
-    char *substring;
+    return (pos < t->length) ? t->input[pos] : '\0';
+}
 
-    // if (c != '\0' || c != '\n') {
-    if (c != '\0') {
-        substring = input + 1;
-        strncpy(input, substring, ELEMENT_MAX);
-    }
+/*
+ * _getc - advance the read position and get the character under it
+ */
+static const char _getc(tokenizer_t *t)
+{
+    if (_peek(t, t->pos) != '\0')
+        t->pos++;
+
+    return _peek(t, t->pos);
+}
+
+/*
+ * _continues_word - check whether the next character carries on the word
+ *
+ * A word piece such as <env> or <subst> followed by one of these is
+ * joined with what follows into a single word.
+ */
+static inline bool _continues_word(const tokenizer_t *t)
+{
+    return _is_class(t->c, WORD_CHARS | CC_ESCAPE | CC_DOLLAR | CC_BACKQUOTE)
+        && t->c != '|';
+}
+
+/*
+ * _join_expansion - let a plain run which ends at '$' or '`' carry on
+ *
+ * The run becomes a WORD token, which the expansion after it joins, as
+ * in --prefix=$(pwd) or lib$ARCH.
+ */
+static const token_t *_join_expansion(tokenizer_t *t)
+{
+    if ((t->token.spec == LETTER || t->token.spec == ALPHANUM
+         || t->token.spec == NUM) && _is_class(t->c, CC_DOLLAR | CC_BACKQUOTE))
+        t->token.spec = WORD;
 
-    return c;
+    return &(t->token);
 }
 
 /**
  * init_tokenizer - Initialize and set up scanninig from input.
+ * @arena: store which holds the tokenizer
  * @input: input from prompt
  */
-tokenizer_t *init_tokenizer(const char *input)
+tokenizer_t *init_tokenizer(arena_t *arena, const char *input)
 {
-    tokenizer_t *t = (tokenizer_t *) malloc(sizeof(tokenizer_t));
-    if (t == NULL) {
-        fprintf(stderr, "Bad allocation (toknizer) \n");
-        exit(EXIT_FAILURE);
-    }
+    return init_tokenizer_slice(arena, input, strlen(input));
+}
+
+/**
+ * init_tokenizer_slice - Initialize and set up scanning of `length' bytes.
+ * @arena: store which holds the tokenizer
+ * @input: start of the input, not necessarily NUL terminated
+ * @length: number of bytes to scan
+ */
+tokenizer_t *
+init_tokenizer_slice(arena_t *arena, const char *input, const size_t length)
+{
+    tokenizer_t *t = (tokenizer_t *) arena_alloc(arena, sizeof(tokenizer_t));
 
-    strncpy(t->input, input, INPUT_MAX);
-    // Read first character from input.
-    t->c = _getc(t->input);
+    // Scan the caller's buffer in place; it must outlive the tokenizer.
+    t->input = input;
+    t->pos = 0;
+    t->length = length;
+    t->heredoc = 0;
+    t->body_pending = false;
+    t->c = _peek(t, t->pos);
     next_token(t);
     
     return t;
@@ -71,12 +195,15 @@ tokenizer_t *init_tokenizer(const char *input)
 /*
  * _init_token - Initialize token
  */
-static token_t *_init_token(token_t *t)
+static token_t *_init_token(tokenizer_t *t)
 {
-    t->spec = END_OF_FILE;
-    memset((void *) t->element, '\0', sizeof(char) * ELEMENT_MAX);
-    
-    return t;
+    t->token.spec = END_OF_FILE;
+    t->token.input = t->input;
+    t->token.offset = t->pos;
+    t->token.length = 0;
+    t->token.raw = false;
+
+    return &(t->token);
 }
 
 /**
@@ -89,83 +216,166 @@ const token_t *current_token(tokenizer_t *t)
 }
 
 /*
- * _append_token - append a character to the tail of token's element
+ * _append_token - extend token's slice up to the current character
  */
-static void _append_token(token_t *token, const char *c)
+static void _append_token(tokenizer_t *t)
 {
-    if (strlen(token->element) < ELEMENT_MAX) {
-        strncat(token->element, c, 1);
-    } else {
-        fprintf(stderr, "error: length of command element is too long.");
-        exit(-1);
+    t->token.length = t->pos + 1 - t->token.offset;
+}
+
+/**
+ * token_text - Copy token's slice into `buf' with backslash escapes removed.
+ * @token: Token whose text will be copied.
+ * @buf: Destination buffer which will be NUL terminated.
+ * @size: Size of `buf'.
+ */
+size_t token_text(const token_t *token, char *buf, size_t size)
+{
+    const char *s = token->input + token->offset;
+    const char *end = s + token->length;
+    size_t n = 0;
+
+    if (size == 0)  return 0;
+    while (s < end && n < size - 1) {
+        if (*s == '\\' && !token->raw && ++s == end)  break;
+        buf[n++] = *s++;
     }
+    buf[n] = '\0';
+
+    return n;
 }
 
 /*
- * _scan_word - Scan <word>
+ * _skip_run - skip a run of plain word characters at once
+ *
+ * `mask' is WORD_CHARS or LETTER_CHARS, that is, every printable ASCII
+ * character other than '$', '<', '>', '&', '`' and '\\' (and '~' for
+ * <letter>).
+ * The read position is advanced past the run, and the length of the run is
+ * returned.  Backslash escapes are left to the per-character scanners.
  */
-static const token_t *_scan_word(tokenizer_t *t)
+static size_t _skip_run(tokenizer_t *t, const unsigned short mask)
 {
-    switch (t->c) {
-    case '\\':
-        t->c = _getc(t->input);
-    case '0': case '1': case '2': case '3': case '4': case '5': case '6':
-    case '7': case '8': case '9':
-    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g':
-    case 'h': case 'i': case 'j': case 'k': case 'l': case 'm': case 'n':
-    case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
-    case 'v': case 'w': case 'x': case 'y': case 'z': 
-    case 'A': case 'B': case 'C': case 'D': case 'E': case 'F': case 'G':
-    case 'H': case 'I': case 'J': case 'K': case 'L': case 'M': case 'N':
-    case 'O': case 'P': case 'Q': case 'R': case 'S': case 'T': case 'U':
-    case 'V': case 'W': case 'X': case 'Y': case 'Z': 
-    case '!': case '"': case '#': case '%': case '\'': case '(': case ')':
-    case '*': case '+': case ',': case '-': case '.': case '/': case ':':
-    case ';': case '?': case '@': case '[': case ']': case '&': /* case '\\': */
-    case '^': case '_': case '`': case '{': case '|': case '}': case '~': case '=':
-        t->token.spec = WORD;
-        _append_token(&(t->token), &(t->c));
-        t->c = _getc(t->input);
-        _scan_word(t);
-        break;
-    default: break;
+    const bool tilde = _is_class('~', mask);
+    const size_t start = t->pos;
+    size_t pos = t->pos;
+
+#if defined(PSH_AVX2)
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    const __m256i dollar = _mm256_set1_epi8('$');
+    const __m256i lt = _mm256_set1_epi8('<');
+    const __m256i gt = _mm256_set1_epi8('>');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i home = _mm256_set1_epi8((tilde) ? '$' : '~');
+    const __m256i ampersand = _mm256_set1_epi8('&');
+    const __m256i backquote = _mm256_set1_epi8('`');
+
+    while (pos + 32 <= t->length) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)(t->input + pos));
+        __m256i stop = _mm256_or_si256(_mm256_cmpeq_epi8(v, dollar),
+                                       _mm256_cmpeq_epi8(v, lt));
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, gt));
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, backslash));
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, home));
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, ampersand));
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, backquote));
+        // Signed comparison also rejects bytes above 0x7f.
+        stop = _mm256_or_si256(stop, _mm256_cmpgt_epi8(space, v));
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, space));
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, del));
+        const unsigned int bits = (unsigned int) _mm256_movemask_epi8(stop);
+        if (bits != 0) {
+            pos += __builtin_ctz(bits);
+            goto out;
+        }
+        pos += 32;
     }
-    
+#endif
+#if defined(PSH_SSE2)
+    {
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i del = _mm_set1_epi8(0x7f);
+        const __m128i dollar = _mm_set1_epi8('$');
+        const __m128i lt = _mm_set1_epi8('<');
+        const __m128i gt = _mm_set1_epi8('>');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i home = _mm_set1_epi8((tilde) ? '$' : '~');
+        const __m128i ampersand = _mm_set1_epi8('&');
+        const __m128i backquote = _mm_set1_epi8('`');
+
+        while (pos + 16 <= t->length) {
+            const __m128i v = _mm_loadu_si128((const __m128i *)(t->input + pos));
+            __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(v, dollar),
+                                        _mm_cmpeq_epi8(v, lt));
+            stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, gt));
+            stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, backslash));
+            stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, home));
+            stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, ampersand));
+            stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, backquote));
+            // Signed comparison also rejects bytes above 0x7f.
+            stop = _mm_or_si128(stop, _mm_cmplt_epi8(v, space));
+            stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, space));
+            stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, del));
+            const int bits = _mm_movemask_epi8(stop);
+            if (bits != 0) {
+                pos += __builtin_ctz(bits);
+                goto out;
+            }
+            pos += 16;
+        }
+    }
+#endif
+    while (_is_class(_peek(t, pos), mask))  pos++;
+#if defined(PSH_SSE2)
+out:
+#endif
+    if (pos != start) {
+        t->pos = pos;
+        t->token.length = pos - t->token.offset;
+        t->c = _peek(t, pos);
+    }
+
+    return pos - start;
+}
+
+/*
+ * _scan_run - Scan characters in `mask' as a token of `spec'
+ */
+static const token_t *_scan_run(tokenizer_t *t, const token_spec_t spec,
+                                const unsigned short mask)
+{
+    for (;;) {
+        if (_skip_run(t, mask) > 0)
+            t->token.spec = spec;
+        if (_is_class(t->c, CC_ESCAPE)) {
+            t->c = _getc(t);
+            if (t->c == '\0')  break;
+        } else if (!_is_class(t->c, mask)) {
+            break;
+        }
+        t->token.spec = spec;
+        _append_token(t);
+        t->c = _getc(t);
+    }
+
     return &(t->token);
 }
 
+/*
+ * _scan_word - Scan <word>
+ */
+static const token_t *_scan_word(tokenizer_t *t)
+{
+    return _scan_run(t, WORD, WORD_CHARS);
+}
+
 /*
  * _scan_letter - Scan <letter>
  */
 static const token_t *_scan_letter(tokenizer_t *t)
 {
-    switch (t->c) {
-    case '\\':
-        t->c = _getc(t->input);
-    case '0': case '1': case '2': case '3': case '4': case '5': case '6':
-    case '7': case '8': case '9':
-    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g':
-    case 'h': case 'i': case 'j': case 'k': case 'l': case 'm': case 'n':
-    case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
-    case 'v': case 'w': case 'x': case 'y': case 'z': 
-    case 'A': case 'B': case 'C': case 'D': case 'E': case 'F': case 'G':
-    case 'H': case 'I': case 'J': case 'K': case 'L': case 'M': case 'N':
-    case 'O': case 'P': case 'Q': case 'R': case 'S': case 'T': case 'U':
-    case 'V': case 'W': case 'X': case 'Y': case 'Z': 
-    case '!': case '"': case '#': case '%': case '\'': case '(': case ')':
-    case '*': case '+': case ',': case '-': case '.': case '/': case ':':
-    case ';': case '?': case '@': case '[': case ']': case '&': /* case '\\': */
-    case '^': case '_': case '`': case '{': case '|': case '}': /* case '~': */
-    case '=':
-        t->token.spec = LETTER;
-        _append_token(&(t->token), &(t->c));
-        t->c = _getc(t->input);
-        _scan_letter(t);
-        break;
-    default: break;
-    }
-    
-    return &(t->token);
+    return _scan_run(t, LETTER, LETTER_CHARS);
 }
 
 /*
@@ -173,67 +383,29 @@ static const token_t *_scan_letter(tokenizer_t *t)
  */
 static const token_t *_scan_only_alphanum(tokenizer_t *t)
 {
-    switch (t->c) {
-    case '0': case '1': case '2': case '3': case '4': case '5': case '6':
-    case '7': case '8': case '9':
-    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g':
-    case 'h': case 'i': case 'j': case 'k': case 'l': case 'm': case 'n':
-    case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
-    case 'v': case 'w': case 'x': case 'y': case 'z': 
-    case 'A': case 'B': case 'C': case 'D': case 'E': case 'F': case 'G':
-    case 'H': case 'I': case 'J': case 'K': case 'L': case 'M': case 'N':
-    case 'O': case 'P': case 'Q': case 'R': case 'S': case 'T': case 'U':
-    case 'V': case 'W': case 'X': case 'Y': case 'Z': 
-    case '_':
-        _append_token(&(t->token), &(t->c));
-        t->c = _getc(t->input);
-        _scan_only_alphanum(t);
-        break;
-    default:  break;
+    while (_is_class(t->c, ALNUM_CHARS)) {
+        _append_token(t);
+        t->c = _getc(t);
     }
+
     return &(t->token);
 }
 
-
 /*
  * _scan_alphanum - Scan <alphanum>
  */
 static const token_t *_scan_alphanum(tokenizer_t *t)
 {
-    switch (t->c) {
-    case '0': case '1': case '2': case '3': case '4': case '5': case '6':
-    case '7': case '8': case '9':
-    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g':
-    case 'h': case 'i': case 'j': case 'k': case 'l': case 'm': case 'n':
-    case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
-    case 'v': case 'w': case 'x': case 'y': case 'z': 
-    case 'A': case 'B': case 'C': case 'D': case 'E': case 'F': case 'G':
-    case 'H': case 'I': case 'J': case 'K': case 'L': case 'M': case 'N':
-    case 'O': case 'P': case 'Q': case 'R': case 'S': case 'T': case 'U':
-    case 'V': case 'W': case 'X': case 'Y': case 'Z': 
-    case '_':
+    while (_is_class(t->c, ALNUM_CHARS)) {
         t->token.spec = ALPHANUM;
-        _append_token(&(t->token), &(t->c));
-        t->c = _getc(t->input);
-        _scan_alphanum(t);
-        break;
-    case '=':
+        _append_token(t);
+        t->c = _getc(t);
+    }
+    if (_is_class(t->c, CC_EQUAL))
         _scan_env_assignment(t);
-        break;
-    case '\\':
-        t->c = _getc(t->input);
-    case '!': case '"': case '#': case '%': case '\'': case '(': case ')':
-    case '*': case '+': case ',': case '-': case '.': case '/': case ':':
-    case ';': case '?': case '@': case '[': case ']': case '&': /* case '\\': */
-    case '^': /* case '_': */ case '`': case '{': case '}': case '~':
-        t->token.spec = LETTER;
-        _append_token(&(t->token), &(t->c));
-        t->c = _getc(t->input);
+    else if (_is_class(t->c, CC_ESCAPE | CC_PUNCT | CC_TILDE))
         _scan_letter(t);
-        break;
-    default: break;
-    }
-    
+
     return &(t->token);
 }
 
@@ -242,104 +414,107 @@ static const token_t *_scan_alphanum(tokenizer_t *t)
  */
 static const token_t *_scan_num(tokenizer_t *t)
 {
-    switch (t->c) {
-    case '0': case '1': case '2': case '3': case '4': case '5': case '6':
-    case '7': case '8': case '9':
+    while (_is_class(t->c, CC_DIGIT)) {
         t->token.spec = NUM;
-        _append_token(&(t->token), &(t->c));
-        t->c = _getc(t->input);
-        _scan_num(t);
-        break;
-    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g':
-    case 'h': case 'i': case 'j': case 'k': case 'l': case 'm': case 'n':
-    case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
-    case 'v': case 'w': case 'x': case 'y': case 'z': 
-    case 'A': case 'B': case 'C': case 'D': case 'E': case 'F': case 'G':
-    case 'H': case 'I': case 'J': case 'K': case 'L': case 'M': case 'N':
-    case 'O': case 'P': case 'Q': case 'R': case 'S': case 'T': case 'U':
-    case 'V': case 'W': case 'X': case 'Y': case 'Z': 
-    case '_':
-        t->token.spec = ALPHANUM;
-        _append_token(&(t->token), &(t->c));
-        t->c = _getc(t->input);
+        _append_token(t);
+        t->c = _getc(t);
+    }
+    switch (_char_class(t->c)) {
+    case CC_ALPHA:
         _scan_alphanum(t);
         break;
-    case '\\':
-        t->c = _getc(t->input);
-    case '!': case '"': case '#': case '%': case '\'': case '(': case ')':
-    case '*': case '+': case ',': case '-': case '.': case '/': case ':':
-    case ';': case '?': case '@': case '[': case ']': case '&': /* case '\\': */
-    case '^': /* case '_': */ case '`': case '{': case '}': case '~': case '=':
-        t->token.spec = LETTER;
-        _append_token(&(t->token), &(t->c));
-        t->c = _getc(t->input);
+    case CC_ESCAPE: case CC_PUNCT: case CC_TILDE: case CC_EQUAL:
         _scan_letter(t);
         break;
-    case '>':
-        t->token.spec = REDIRECT_OUT;
-        _scan_redirect_out(t);
-        break;
-    case '<':
-        t->token.spec = REDIRECT_IN;
-        _scan_redirect_in(t);
+    case CC_REDIRECT:
+        if (t->c == '>')
+            _scan_redirect_out(t);
+        else
+            _scan_redirect_in(t);
         break;
     default: break;
     }
+
     return &(t->token);
 }
 
 /*
- * __scan_env - real scanner for <env>
+ * _scan_env - Scan <env>
  */
-static const token_t *__scan_env(tokenizer_t *t, char *key)
+static const token_t *_scan_env(tokenizer_t *t)
 {
-    switch (t->c) {
-    case '$':
-        t->token.spec = ENV;
-        t->c = _getc(t->input);
-        __scan_env(t, key);
-        break;
-    case '{':
-        t->c = _getc(t->input);
-        __scan_env(t, key);
-        break;
-    case '0': case '1': case '2': case '3': case '4': case '5': case '6':
-    case '7': case '8': case '9':
-    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g':
-    case 'h': case 'i': case 'j': case 'k': case 'l': case 'm': case 'n':
-    case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
-    case 'v': case 'w': case 'x': case 'y': case 'z': 
-    case 'A': case 'B': case 'C': case 'D': case 'E': case 'F': case 'G':
-    case 'H': case 'I': case 'J': case 'K': case 'L': case 'M': case 'N':
-    case 'O': case 'P': case 'Q': case 'R': case 'S': case 'T': case 'U':
-    case 'V': case 'W': case 'X': case 'Y': case 'Z': 
-        strncat(key, &(t->c), 1);
-        t->c = _getc(t->input);
-        __scan_env(t, key);
-        break;
-    case ' ': case '\t': case '\n': case '\0':
-        strncat(t->token.element, key, strlen(key));
-        break;
-    case '}':
-        t->c = _getc(t->input);
-    default:
-        if (t->token.spec == ENV)  t->token.spec = ENV_WORD;
-        strncat(t->token.element, key, strlen(key));
-        break;
+    t->token.spec = ENV;
+    t->token.offset = t->pos + 1;
+    t->c = _getc(t);
+    if (t->c == '(')
+        return _scan_subst(t, ')');
+    if (t->c == '{') {
+        t->token.offset = t->pos + 1;
+        t->c = _getc(t);
     }
-    
+    while (_is_class(t->c, ALNUM_CHARS) && t->c != '_') {
+        _append_token(t);
+        t->c = _getc(t);
+    }
+    if (t->c == '}')
+        t->c = _getc(t);
+    if (_continues_word(t))
+        t->token.spec = ENV_WORD;
+
     return &(t->token);
 }
 
 /*
- * _scan_env - Scan <env>
+ * _scan_subst - Scan <subst>, the command between '`' or "$(" and `close'
+ *
+ * The token is the text of the command.  Parentheses nest inside "$(",
+ * and a backslash keeps the next character from closing it.
  */
-static const token_t *_scan_env(tokenizer_t *t)
+static const token_t *_scan_subst(tokenizer_t *t, const char close)
+{
+    int depth = 0;
+
+    t->token.spec = SUBST;
+    t->token.offset = t->pos + 1;
+    t->token.length = 0;
+    for (t->c = _getc(t); t->c != close || depth > 0; t->c = _getc(t)) {
+        if (t->c == '\0') {
+            t->token.spec = ERROR;
+            return &(t->token);
+        }
+        if (close == ')' && t->c == '(')
+            depth++;
+        else if (close == ')' && t->c == ')')
+            depth--;
+        else if (t->c == '\\' && _peek(t, t->pos + 1) != '\0')
+            t->c = _getc(t);
+        _append_token(t);
+    }
+    t->c = _getc(t);
+    if (_continues_word(t))
+        t->token.spec = SUBST_WORD;
+
+    return &(t->token);
+}
+
+/*
+ * _scan_proc_subst - Scan <proc_subst>, the command between "<(" or ">(" and ')'
+ *
+ * The body nests like "$(", so it is scanned as a <subst> whose spec is
+ * then turned into the direction of the substitution.
+ */
+static const token_t *_scan_proc_subst(tokenizer_t *t)
 {
-    char c[ELEMENT_MAX];
-    memset(c, 0, ELEMENT_MAX);
-        
-    return __scan_env(t, c);
+    const bool in = (t->c == '<');
+
+    t->c = _getc(t);
+    _scan_subst(t, ')');
+    if (t->token.spec == SUBST)
+        t->token.spec = in ? PROC_SUBST_IN : PROC_SUBST_OUT;
+    else if (t->token.spec == SUBST_WORD)
+        t->token.spec = in ? PROC_SUBST_IN_WORD : PROC_SUBST_OUT_WORD;
+
+    return &(t->token);
 }
 
 /*
@@ -347,16 +522,13 @@ static const token_t *_scan_env(tokenizer_t *t)
  */
 static const token_t *_scan_home(tokenizer_t *t)
 {
-    switch (t->c) {
-    case '~':
-        t->token.spec = HOME;
-        t->c = _getc(t->input);
-        _scan_only_alphanum(t);
-        if (!isspace(t->c)) t->token.spec = HOME_WORD;
-        break;
-    default: break;
-    }
-    
+    t->token.spec = HOME;
+    t->token.offset = t->pos + 1;
+    t->c = _getc(t);
+    _scan_only_alphanum(t);
+    if (_continues_word(t))
+        t->token.spec = HOME_WORD;
+
     return &(t->token);
 }
 
@@ -365,35 +537,135 @@ static const token_t *_scan_home(tokenizer_t *t)
  */
 static const token_t *_scan_env_assignment(tokenizer_t *t)
 {
-    switch (t->c) {
-    case '=':
-        t->token.spec = ENV_ASSIGNMENT;
-        _append_token(&(t->token), &(t->c));
-        t->c = _getc(t->input);
-        _scan_word(t);
-        break;
-    default: break;
-    }
+    t->token.spec = ENV_ASSIGNMENT;
+    _append_token(t);
+    t->c = _getc(t);
+    _scan_word(t);
+    t->token.spec = ENV_ASSIGNMENT;
 
     return &(t->token);
 }
 
+/*
+ * _scan_delimiter - get the word after "<<" which starts at `pos'
+ *
+ * Sets `*start' and `*length' to the delimiter with one pair of quotes
+ * around it removed, and returns the position past it.
+ */
+static size_t _scan_delimiter(const char *s, const size_t length, size_t pos,
+                              size_t *start, size_t *delimiter_length)
+{
+    while (pos < length && (s[pos] == ' ' || s[pos] == '\t'))
+        pos++;
+    *start = pos;
+    while (pos < length && !_is_class(s[pos], CC_BLANK | CC_PIPE
+                                      | CC_AMPERSAND | CC_REDIRECT))
+        pos++;
+    *delimiter_length = pos - *start;
+    if (*delimiter_length >= 2 && (s[*start] == '\'' || s[*start] == '"')
+        && s[pos - 1] == s[*start]) {
+        (*start)++;
+        *delimiter_length -= 2;
+    }
+
+    return pos;
+}
+
+/**
+ * next_heredoc - find the next "<<word" on a line
+ * @line: the line, not necessarily NUL terminated
+ * @length: length of `line'
+ * @pos: where to start looking; set to just past the delimiter found
+ * @delimiter: set to the delimiter, without quotes
+ * @delimiter_length: set to the length of `delimiter'
+ *
+ * The body of the here-document is the lines following `line' up to one
+ * which holds only the delimiter.  Returns false when there is none.
+ */
+bool next_heredoc(const char *line, const size_t length, size_t *pos,
+                  const char **delimiter, size_t *delimiter_length)
+{
+    const char *found;
+    size_t i, start;
+
+    for (i = *pos; i + 1 < length; i = found - line + 1) {
+        found = memchr(line + i, '<', length - i - 1);
+        if (found == NULL)  break;
+        i = found - line;
+        if (line[i + 1] != '<' || (i > 0 && line[i - 1] == '<'))
+            continue;
+        if (i + 2 < length && line[i + 2] == '<') {
+            found++;  // "<<<" is a here-string
+            continue;
+        }
+        *pos = _scan_delimiter(line, length, i + 2, &start, delimiter_length);
+        *delimiter = line + start;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * _scan_heredoc - Scan the delimiter of "<<" and locate its body
+ *
+ * The first body starts on the line after the command, and each further
+ * one after the delimiter line of the one before.  The body becomes the
+ * next token.
+ */
+static void _scan_heredoc(tokenizer_t *t)
+{
+    const char *line;
+    size_t start, length, body;
+
+    t->pos = _scan_delimiter(t->input, t->length, t->pos, &start, &length);
+    t->c = _peek(t, t->pos);
+    if (t->heredoc == 0) {
+        line = memchr(t->input + t->pos, '\n', t->length - t->pos);
+        t->heredoc = (line == NULL) ? t->length
+            : (size_t)(line - t->input) + 1;
+    }
+    body = t->heredoc;
+    for (;;) {
+        line = memchr(t->input + t->heredoc, '\n', t->length - t->heredoc);
+        if (line == NULL)
+            line = t->input + t->length;
+        if ((size_t)(line - (t->input + t->heredoc)) == length
+            && memcmp(t->input + t->heredoc, t->input + start, length) == 0) {
+            t->body_length = t->heredoc - body;
+            break;
+        }
+        if (line == t->input + t->length) {
+            t->body_length = t->length - body;  // no delimiter line
+            break;
+        }
+        t->heredoc = (size_t)(line - t->input) + 1;
+    }
+    t->heredoc = (line == t->input + t->length) ?
+        t->length : (size_t)(line - t->input) + 1;
+    t->body_offset = body;
+    t->body_pending = true;
+}
+
 /*
  * _scan_redirect_in - Scan <redirect_in>
  */
 static const token_t *_scan_redirect_in(tokenizer_t *t)
 {
-    switch (t->c) {
-    case '<':
-        t->token.spec = REDIRECT_IN;
-        t->c = _getc(t->input);
-        switch (t->c) {
-        case '>':
-            t->token.spec = REDIRECT_IN_OUT;
-            break;
-        default: break;
+    t->token.spec = REDIRECT_IN;
+    t->c = _getc(t);
+    if (t->c == '>') {
+        t->token.spec = REDIRECT_IN_OUT;
+        t->c = _getc(t);
+    } else if (t->c == '<') {
+        t->c = _getc(t);
+        if (t->c == '<') {
+            t->token.spec = HERE_STRING;
+            t->c = _getc(t);
+        } else {
+            t->token.spec = HEREDOC;
+            _scan_heredoc(t);
         }
-    default: break;
     }
 
     return &(t->token);
@@ -404,34 +676,41 @@ static const token_t *_scan_redirect_in(tokenizer_t *t)
  */
 static const token_t *_scan_redirect_out(tokenizer_t *t)
 {
+    t->token.spec = REDIRECT_OUT;
+    t->c = _getc(t);
     switch (t->c) {
     case '>':
-        t->token.spec = REDIRECT_OUT;
-        t->c = _getc(t->input);
-        switch (t->c) {
-        case '>':
-            t->token.spec = REDIRECT_OUT_APPEND;
-            break;
-        case '&':
-            t->token.spec = REDIRECT_OUT_COMPOSITION;
-            break;
-        default: break;
-        }
+        t->token.spec = REDIRECT_OUT_APPEND;
+        t->c = _getc(t);
+        break;
+    case '&':
+        t->token.spec = REDIRECT_OUT_COMPOSITION;
+        t->c = _getc(t);
         break;
     default: break;
     }
-    
+
     return &(t->token);
 }
 
- 
 /**
  * next_token - Scan input and return next token.
  * @t: Token information and next character.
  */
 const token_t *next_token(tokenizer_t *t)
 {
-    _init_token(&(t->token));
+    if (t->body_pending) {
+        // The body lies past the end of the line; the position stays.
+        _init_token(t);
+        t->token.spec = HEREDOC_BODY;
+        t->token.offset = t->body_offset;
+        t->token.length = t->body_length;
+        t->token.raw = true;
+        t->body_pending = false;
+        return &(t->token);
+    }
+    while (_is_class(t->c, CC_BLANK) && t->c != '\n') t->c = _getc(t);
+    _init_token(t);
     return _next_token(t);
 }
 
@@ -441,59 +720,50 @@ const token_t *next_token(tokenizer_t *t)
  */
 const token_t  *_next_token(tokenizer_t *t)
 {
-    while (isspace(t->c) && t->c != '\n') t->c = _getc(t->input);
-    switch (t->c) {
-    case EOF:
-        t->token.spec = END_OF_FILE;
-        break;
-    case '\n':
+    while (_is_class(t->c, CC_BLANK) && t->c != '\n') t->c = _getc(t);
+    switch (_char_class(t->c)) {
+    case CC_BLANK:
         t->token.spec = END_OF_LINE;
         break;
-    case '0': case '1': case '2': case '3': case '4': case '5': case '6':
-    case '7': case '8': case '9':
+    case CC_DIGIT:
         t->token.spec = NUM;
         _scan_num(t);
+        _join_expansion(t);
         break;
-    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g':
-    case 'h': case 'i': case 'j': case 'k': case 'l': case 'm': case 'n':
-    case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
-    case 'v': case 'w': case 'x': case 'y': case 'z': 
-    case 'A': case 'B': case 'C': case 'D': case 'E': case 'F': case 'G':
-    case 'H': case 'I': case 'J': case 'K': case 'L': case 'M': case 'N':
-    case 'O': case 'P': case 'Q': case 'R': case 'S': case 'T': case 'U':
-    case 'V': case 'W': case 'X': case 'Y': case 'Z':
-    case '_':
+    case CC_ALPHA:
         t->token.spec = ALPHANUM;
         _scan_alphanum(t);
+        _join_expansion(t);
         break;
-    case '\\':
-        t->c = _getc(t->input);
-    case '!': case '"': case '#': case '%': case '\'': case '(': case ')':
-    case '*': case '+': case ',': case '-': case '.': case '/': case ':':
-    case ';': case '?': case '@': case '[': case ']': case '&': /* case '\\': */
-    case '^': /* case '_': */case '`': case '{': case '}':  case '=':
+    case CC_ESCAPE: case CC_PUNCT: case CC_EQUAL:
         t->token.spec = LETTER;
         _scan_letter(t);
+        _join_expansion(t);
         break;
-    case '$':
-        t->token.spec = ENV;
+    case CC_DOLLAR:
         _scan_env(t);
         break;
-    case '~':
-        t->token.spec = HOME;
+    case CC_TILDE:
         _scan_home(t);
         break;
-    case '<':
-        t->token.spec = REDIRECT_IN;
-        _scan_redirect_in(t);
-        break;
-    case '>':
-        t->token.spec = REDIRECT_OUT;
-        _scan_redirect_out(t);
+    case CC_REDIRECT:
+        if (_peek(t, t->pos + 1) == '(')
+            _scan_proc_subst(t);
+        else if (t->c == '<')
+            _scan_redirect_in(t);
+        else
+            _scan_redirect_out(t);
         break;
-    case '|':
+    case CC_PIPE:
         t->token.spec = PIPED_COMMAND;
-        t->c = _getc(t->input);
+        t->c = _getc(t);
+        break;
+    case CC_BACKQUOTE:
+        _scan_subst(t, '`');
+        break;
+    case CC_AMPERSAND:
+        t->token.spec = BACKGROUND;
+        t->c = _getc(t);
         break;
     default: break;
     }
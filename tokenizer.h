@@ -13,6 +13,7 @@
 #include <stdbool.h>
 #include <sys/types.h>
 
+#include "arena.h"
 #include "consts.h"
 
 typedef enum token_spec {
@@ -20,6 +21,8 @@ typedef enum token_spec {
     COMMAND,
     REDIRECT_IN,
     REDIRECT_IN_OUT,
+    HEREDOC,
+    HERE_STRING,
     REDIRECT_OUT,
     REDIRECT_OUT_APPEND,
     REDIRECT_OUT_COMPOSITION,
@@ -34,31 +37,88 @@ typedef enum token_spec {
     HOME_WORD,
     ENV,
     ENV_WORD,
+    SUBST,
+    SUBST_WORD,
+    PROC_SUBST_IN,
+    PROC_SUBST_IN_WORD,
+    PROC_SUBST_OUT,
+    PROC_SUBST_OUT_WORD,
+    HEREDOC_BODY,
     NUM,
     ENV_ASSIGNMENT,
     LETTER,
     WORD,
+    BACKGROUND,
     ERROR,
     END_OF_LINE,
     END_OF_FILE
 } token_spec_t;
 
+/*
+ * A token scanned by the tokenizer refers to its text as the slice
+ * [offset, offset + length) of `input'; backslash escapes are kept in the
+ * slice and removed by token_text(), except in a `raw' token such as a
+ * here-document body.  Tokens owned by tree nodes carry their own copy of
+ * the text in `text', which is NULL for abstract nodes.
+ */
 typedef struct token {
     token_spec_t spec;
-    char element[ELEMENT_MAX];
+    const char *input;
+    size_t offset;
+    size_t length;
+    bool raw;
+    str_t *text;
 } token_t;
 
 typedef struct tokenizer {
     token_t token;
     char c;
-    char input[INPUT_MAX];
+    const char *input;
+    size_t pos;
+    size_t length;
+    size_t heredoc;  // where the next here-document body starts, or 0
+    size_t body_offset;  // body of the "<<" just scanned
+    size_t body_length;
+    bool body_pending;  // the body is the next token
 } tokenizer_t;
 
 /**
  * init_tokenizer - Initialize and set up scanninig from input.
+ * @arena: store which holds the tokenizer
  * @input: input from prompt
  */
-tokenizer_t *init_tokenizer(const char *input);
+tokenizer_t *init_tokenizer(arena_t *arena, const char *input);
+
+/**
+ * init_tokenizer_slice - Initialize and set up scanning of `length' bytes.
+ * @arena: store which holds the tokenizer
+ * @input: start of the input, not necessarily NUL terminated
+ * @length: number of bytes to scan
+ */
+tokenizer_t *
+init_tokenizer_slice(arena_t *arena, const char *input, const size_t length);
+
+/**
+ * next_heredoc - find the next "<<word" on a line
+ * @line: the line, not necessarily NUL terminated
+ * @length: length of `line'
+ * @pos: where to start looking; set to just past the delimiter found
+ * @delimiter: set to the delimiter, without quotes
+ * @delimiter_length: set to the length of `delimiter'
+ *
+ * The body of the here-document is the lines following `line' up to one
+ * which holds only the delimiter.  Returns false when there is none.
+ */
+bool next_heredoc(const char *line, const size_t length, size_t *pos,
+                  const char **delimiter, size_t *delimiter_length);
+
+/**
+ * token_text - Copy token's slice into `buf' with backslash escapes removed.
+ * @token: Token whose text will be copied.
+ * @buf: Destination buffer which will be NUL terminated.
+ * @size: Size of `buf'.
+ */
+size_t token_text(const token_t *token, char *buf, size_t size);
 
 /**
  * current_token - Get current token.
@@ -17,127 +17,112 @@
 #include "tree.h"
 
 /*
- * _init_tree_head - initialize tree head
+ * _grow_tree - double the node array of `tree'
  */
-static inline void _init_tree_head(node_t *node)
+static void _grow_tree(tree_t *tree)
 {
-    tree_t *head = (tree_t *) malloc(sizeof(tree_t));
-    if (head == NULL) {
-        fprintf(stderr, "Bad allocation (tree head) \n");
-        exit(EXIT_FAILURE);
-    }
-    /* node->head = head; */
-    /* node->head->left = node->head->right = NULL; */
-    node->left = NULL;
-    node->right = NULL;
+    const node_id_t capacity = tree->capacity * 2;
+    node_t *nodes = (node_t *) arena_alloc(tree->arena,
+                                           sizeof(node_t) * capacity);
+
+    memcpy(nodes, tree->nodes, sizeof(node_t) * tree->count);
+    tree->nodes = nodes;
+    tree->capacity = capacity;
 }
 
 /*
- * _init_node - initialize node with token `origin`
+ * _init_node - initialize node with token `origin'
  */
-static node_t *_init_node(const token_t *origin)
+static node_id_t _init_node(tree_t *tree, const token_t *origin)
 {
-    token_t *token = (token_t *) malloc(sizeof(token_t));
-    node_t *node = (node_t *) malloc(sizeof(node_t));
+    node_t *node;
 
-    if (token == NULL) {
-        fprintf(stderr, "Bad allocation (token) \n");
-        exit(EXIT_FAILURE);
+    if (tree->count == tree->capacity)  _grow_tree(tree);
+    node = &(tree->nodes[tree->count]);
+    node->left = NO_NODE;
+    node->right = NO_NODE;
+    node->spec = origin->spec;
+    if (origin->input != NULL) {
+        // Escapes only shrink the text, so the slice length is enough.
+        node->text = arena_str(tree->arena, NULL, origin->length);
+        node->text->length = token_text(origin, node->text->data,
+                                        origin->length + 1);
+    } else {
+        node->text = origin->text;
     }
-    if (node == NULL) {
-        fprintf(stderr, "Bad allocation (node) \n");
-        exit(EXIT_FAILURE);
-    }
-    // _init_tree_head(node);
-    node->left = NULL;
-    node->right = NULL;
-    node->oldstreamfd = 0;
-    token->spec = origin->spec;
-    memset(token->element, '\0', ELEMENT_MAX);
-    strncpy(token->element, origin->element, strlen(origin->element));
-    node->token = token;
     
-    return node;
+    return tree->count++;
+}
+
+/**
+ * init_tree - initialize empty syntax tree
+ * @arena: store which holds the tree
+ */
+tree_t *init_tree(arena_t *arena)
+{
+    tree_t *tree = (tree_t *) arena_alloc(arena, sizeof(tree_t));
+
+    tree->arena = arena;
+    tree->capacity = TREE_INITIAL_NODES;
+    tree->nodes = (node_t *) arena_alloc(arena,
+                                         sizeof(node_t) * tree->capacity);
+    tree->count = 1;  // skip NO_NODE
+    tree->root = NO_NODE;
+    tree->background = false;
+    tree->source = NULL;
+    tree->source_length = 0;
+
+    return tree;
 }
 
 /**
  * init_node - initialize tree node
+ * @tree: tree which holds the node
  * @token: token by which node will be initialized
  */
-node_t *init_node(const token_t *token)
+node_id_t init_node(tree_t *tree, const token_t *token)
 {
-    return _init_node(token);
+    return _init_node(tree, token);
 }
 
 /**
  * init_root - initialize tree root
- * @root: the root of syntax tree
+ * @tree: tree which holds the node
  */
-node_t *init_root(node_t *root)
+node_id_t init_root(tree_t *tree)
 {
-    token_t *token = (token_t *) malloc(sizeof(token_t));
-    
-    if (token == NULL) {
-        print_error("Bad allocation (token) \n", root);
-    }
-    token->spec = PIPED_COMMAND;
-    return init_node(token);
+    tree->root = init_abstract_node(tree, PIPED_COMMAND);
+    return tree->root;
 }
 
 /**
  * init_abstract_node - initialize tree node only with it's spec
+ * @tree: tree which holds the node
  * @spec: token's specifier
  */
-node_t *init_abstract_node(const token_spec_t spec)
+node_id_t init_abstract_node(tree_t *tree, const token_spec_t spec)
 {
-    token_t *token = (token_t *) malloc(sizeof(token_t));
-    node_t *node;
+    token_t token;
 
-    if (token == NULL) {
-        fprintf(stderr, "Bad allocation (token) \n");
-        exit(EXIT_FAILURE);
-    }
-    token->spec = spec;
-    memset(token->element, '\0', ELEMENT_MAX);
-    node = _init_node(token);
-    
-    return node;
+    token.spec = spec;
+    token.input = NULL;
+    token.text = NULL;
+
+    return _init_node(tree, &token);
 }
 
 /**
  * create_tree - create tree from parent which left is `left` and right is `right`
+ * @tree: tree which holds the nodes
  * @parent: parent node
  * @left: left side child of parent node
  * @right: right side child of parent node
  */
-node_t *create_tree(node_t *parent, const node_t *left, const node_t *right)
+node_id_t create_tree(tree_t *tree, node_id_t parent,
+                      node_id_t left, node_id_t right)
 {
-    /* parent->head->left = (left != NULL)? left->head : NULL; */
-    /* parent->head->right = (right != NULL)? right->head : NULL; */
-    parent->left = (node_t *)left;
-    parent->right = (node_t *)right;
+    tree->nodes[parent].left = left;
+    tree->nodes[parent].right = right;
 
     return parent;
 }
-
-/**
- * free_nodes - free nodes which are children of `current` node recursively
- * @current: current node which will be freed
- */
-void free_nodes(node_t *current, node_t *root)
-{
-    node_t *left, *right;
-    // if (current->head->left != NULL) {
-    if (current->left != NULL) {
-        // left = container_of(&(current->head->left), node_t, head);
-        left = (node_t *)current->left;
-        free_nodes(left, root);
-    }
-    // if (current->head->left != NULL) {
-    if (current->right != NULL) {
-        // right = container_of(&(current->head->right), node_t, head);
-        right = (node_t *)current->right;
-        free_nodes(right, root);
-    }    
-    free(current);
-}
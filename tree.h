@@ -10,21 +10,43 @@
 #ifndef PSH_TREE_H_
 #define PSH_TREE_H_
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
-typedef struct tree_head {
-    struct tree_head *left;
-    struct tree_head *right;
-} tree_t;
+#define TREE_INITIAL_NODES  64
+
+/*
+ * Nodes refer to their children by index into the node array of their
+ * tree.  Index 0 is never used so that NO_NODE can stand for "no child".
+ */
+typedef uint32_t node_id_t;
+
+#define NO_NODE  ((node_id_t) 0)
 
 typedef struct node {
-    token_t *token;
-    // tree_t *head;
-    struct node *left;
-    struct node *right;
-    int oldstreamfd;
+    str_t *text;  // NULL for abstract nodes
+    node_id_t left;
+    node_id_t right;
+    uint8_t spec;  // token_spec_t
 } node_t;
 
+/*
+ * A syntax tree is one contiguous array of nodes allocated from the
+ * line's arena.  It doubles when full, so node pointers are only stable
+ * once parsing is over; the parser deals in node_id_t instead.
+ */
+typedef struct tree {
+    node_t *nodes;
+    node_id_t count;
+    node_id_t capacity;
+    node_id_t root;
+    bool background;  // the line ended with '&'
+    const char *source;  // the line, for job listings
+    size_t source_length;
+    arena_t *arena;
+} tree_t;
+
 /*
  * conteiner_of - macro to get parent structure
  */
@@ -32,43 +54,75 @@ typedef struct node {
             const typeof ( ((type *)0)->member )*__mptr = (ptr);    \
             (type *)( (char *)__mptr - offsetof(type, member) );})
 
+/*
+ * tree_node - get the node `id' of `tree', or NULL for NO_NODE
+ */
+static inline node_t *tree_node(const tree_t *tree, const node_id_t id) {
+    return (id == NO_NODE)? NULL : &(tree->nodes[id]);
+}
+
+/*
+ * _left - get the left child of `node'
+ */
+static inline node_t *_left(const tree_t *tree, const node_t *node) {
+    return tree_node(tree, node->left);
+}
+
+/*
+ * _right - get the right child of `node'
+ */
+static inline node_t *_right(const tree_t *tree, const node_t *node) {
+    return tree_node(tree, node->right);
+}
+
 /*
  * _is_abstract_node - check whether the node is abstract node or not.
  */
 static inline bool _is_abstract_node(const node_t *node) {
-    return (strlen(node->token->element) == 0)? true : false;
+    return (node->text == NULL || node->text->length == 0)? true : false;
 }
 
+/*
+ * _node_text - get the text of the node, or "" for abstract nodes
+ */
+static inline const char *_node_text(const node_t *node) {
+    return (node->text != NULL)? node->text->data : "";
+}
+
+/**
+ * init_tree - initialize empty syntax tree
+ * @arena: store which holds the tree
+ */
+tree_t *init_tree(arena_t *arena);
+
 /**
  * init_node - initialize tree node
+ * @tree: tree which holds the node
  * @token: token by which node will be initialized
  */
-node_t *init_node(const token_t *token);
+node_id_t init_node(tree_t *tree, const token_t *token);
 
 /**
  * init_root - initialize tree root
- * @root: the root of syntax tree
+ * @tree: tree which holds the node
  */
-node_t *init_root();
+node_id_t init_root(tree_t *tree);
 
 /**
  * init_abstract_node - initialize tree node with it's spec and without it's token
+ * @tree: tree which holds the node
  * @spec: token's specifier
  */
-node_t *init_abstract_node(token_spec_t spec);
+node_id_t init_abstract_node(tree_t *tree, token_spec_t spec);
 
 /**
  * create_tree - create tree from parent which left is `left` and right is `right`
+ * @tree: tree which holds the nodes
  * @parent: parent node
  * @left: left side child of parent node
  * @right: right side child of parent node
  */
-node_t *create_tree(node_t *parent, const node_t *left, const node_t *right);
-
-/**
- * free_nodes - free nodes which are children of `current` node recursively
- * @current: current node which will be freed
- */
-void free_nodes(node_t *current, node_t *root);
+node_id_t create_tree(tree_t *tree, node_id_t parent,
+                      node_id_t left, node_id_t right);
 
 #endif  // PSH_TREE_H_
@@ -0,0 +1,201 @@
+/*
+ * vars.c - shell variables and the environment of spawned commands
+ *
+ * This source code is licensed under the MIT License.
+ * See the file COPYING for more details.
+ *
+ * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "vars.h"
+
+/*
+ * A variable is kept as one "NAME=value" string so that the envp array
+ * can point straight at it.
+ */
+typedef struct var {
+    char *pair;  // NULL for an empty slot
+    size_t name_length;
+    uint32_t hash;
+    bool exported;
+} var_t;
+
+typedef struct var_table {
+    var_t *vars;
+    size_t size;  // always a power of two
+    size_t count;
+    size_t exported;
+    char **envp;
+    size_t envp_bytes;
+    bool envp_dirty;
+} var_table_t;
+
+static var_table_t table = { NULL, 0, 0, 0, NULL, 0, true };
+
+/*
+ * _xmalloc - malloc which never returns NULL
+ */
+static void *_xmalloc(const size_t size)
+{
+    void *p = malloc(size);
+
+    if (p == NULL) {
+        fprintf(stderr, "Bad allocation (vars) \n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/*
+ * _find_slot - get the slot which holds `name' or where it would go
+ */
+static var_t *_find_slot(var_t *vars, const size_t size, const char *name,
+                         const size_t length, const uint32_t hash)
+{
+    size_t i = hash & (size - 1);
+
+    while (vars[i].pair != NULL) {
+        if (vars[i].hash == hash && vars[i].name_length == length
+            && memcmp(vars[i].pair, name, length) == 0)
+            break;
+        i = (i + 1) & (size - 1);
+    }
+    return &(vars[i]);
+}
+
+/*
+ * _grow_table - double the table once it is 70% full
+ */
+static void _grow_table(void)
+{
+    const size_t size = (table.size == 0) ? VARS_INITIAL_SIZE : table.size * 2;
+    var_t *vars = (var_t *) calloc(size, sizeof(var_t));
+    const var_t *var;
+    size_t i;
+
+    if (vars == NULL) {
+        fprintf(stderr, "Bad allocation (vars) \n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < table.size; i++) {
+        var = &(table.vars[i]);
+        if (var->pair != NULL)
+            *_find_slot(vars, size, var->pair, var->name_length,
+                        var->hash) = *var;
+    }
+    free(table.vars);
+    table.vars = vars;
+    table.size = size;
+}
+
+/**
+ * init_vars - load the variables the shell was started with
+ * @envp: environment of the shell; every variable in it is exported
+ */
+void init_vars(char **envp)
+{
+    const char *equal;
+
+    for (; *envp != NULL; envp++) {
+        equal = strchr(*envp, '=');
+        if (equal == NULL)  continue;
+        var_set(*envp, equal - *envp, equal + 1, true);
+    }
+}
+
+/**
+ * var_get - get the value of variable `name', or NULL when it is unset
+ * @name: variable name
+ */
+const char *var_get(const char *name)
+{
+    const size_t length = strlen(name);
+    const var_t *var;
+
+    if (table.size == 0)  return NULL;
+    var = _find_slot(table.vars, table.size, name, length,
+                     hash_string(name, length));
+    if (var->pair == NULL)  return NULL;
+
+    return var->pair + length + 1;
+}
+
+/**
+ * var_set - assign `value' to variable `name'
+ * @name: variable name
+ * @length: length of `name', which need not be NUL terminated
+ * @value: new value
+ * @export: also export the variable; an exported variable stays exported
+ */
+void var_set(const char *name, const size_t length, const char *value,
+             const bool export)
+{
+    const uint32_t hash = hash_string(name, length);
+    const size_t value_length = strlen(value);
+    char *pair = (char *) _xmalloc(length + value_length + 2);
+    var_t *var;
+
+    // Build the new pair first; `name' or `value' may point into the old.
+    memcpy(pair, name, length);
+    pair[length] = '=';
+    memcpy(pair + length + 1, value, value_length + 1);
+
+    if ((table.count + 1) * 10 > table.size * 7)  _grow_table();
+    var = _find_slot(table.vars, table.size, pair, length, hash);
+    if (var->pair == NULL) {
+        var->name_length = length;
+        var->hash = hash;
+        var->exported = false;
+        table.count++;
+    }
+    free(var->pair);
+    var->pair = pair;
+    if (export && !var->exported) {
+        var->exported = true;
+        table.exported++;
+    }
+    if (var->exported)
+        table.envp_dirty = true;
+
+    // Remembered command locations are only valid for the old $PATH.
+    if (length == 4 && memcmp(name, "PATH", 4) == 0)
+        hash_clear();
+}
+
+/**
+ * var_envp - get the environment for spawned commands
+ */
+char **var_envp(void)
+{
+    size_t i, n = 0;
+
+    if (!table.envp_dirty)  return table.envp;
+    free(table.envp);
+    table.envp = (char **) _xmalloc(sizeof(char *) * (table.exported + 1));
+    table.envp_bytes = sizeof(char *);
+    for (i = 0; i < table.size; i++) {
+        if (table.vars[i].pair != NULL && table.vars[i].exported) {
+            table.envp[n++] = table.vars[i].pair;
+            table.envp_bytes += strlen(table.vars[i].pair) + 1 + sizeof(char *);
+        }
+    }
+    table.envp[n] = NULL;
+    table.envp_dirty = false;
+
+    return table.envp;
+}
+
+/**
+ * var_envp_bytes - get how much the environment takes in a new process
+ */
+size_t var_envp_bytes(void)
+{
+    var_envp();
+    return table.envp_bytes;
+}
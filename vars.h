@@ -0,0 +1,55 @@
+/*
+ * vars.h - shell variables and the environment of spawned commands
+ *
+ * This source code is licensed under the MIT License.
+ * See the file COPYING for more details.
+ *
+ * @author: Taku Fukushima <tfukushima@dcl.info.waseda.ac.jp>
+ */
+
+#ifndef PSH_VARS_H_
+#define PSH_VARS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define VARS_INITIAL_SIZE  256
+
+/**
+ * init_vars - load the variables the shell was started with
+ * @envp: environment of the shell; every variable in it is exported
+ */
+void init_vars(char **envp);
+
+/**
+ * var_get - get the value of variable `name', or NULL when it is unset
+ * @name: variable name
+ */
+const char *var_get(const char *name);
+
+/**
+ * var_set - assign `value' to variable `name'
+ * @name: variable name
+ * @length: length of `name', which need not be NUL terminated
+ * @value: new value
+ * @export: also export the variable; an exported variable stays exported
+ */
+void var_set(const char *name, const size_t length, const char *value,
+             const bool export);
+
+/**
+ * var_envp - get the environment for spawned commands
+ *
+ * The array is rebuilt only after an exported variable has changed, and
+ * stays valid until the next change.
+ */
+char **var_envp(void);
+
+/**
+ * var_envp_bytes - get how much the environment takes in a new process
+ *
+ * Counts the strings of var_envp() with their NULs and pointers.
+ */
+size_t var_envp_bytes(void);
+
+#endif  // PSH_VARS_H_